@@ -0,0 +1,501 @@
+#pragma once
+
+#include "output.h"
+#include "stmt.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// the widest vector registers the build targets. arithmetic on reg uses the
+// compiler's vector operators; the rest goes through intrinsics. without
+// either instruction set the kernels below run their scalar loops only.
+#if defined(__AVX__)
+struct lanes final {
+  using reg = __m256d;
+  static constexpr std::size_t width__{4};
+
+  static reg load(const double *p) noexcept { return _mm256_loadu_pd(p); }
+  static void store(double *p, reg x) noexcept { _mm256_storeu_pd(p, x); }
+  static reg broadcast(double x) noexcept { return _mm256_set1_pd(x); }
+  static reg min(reg x, reg y) noexcept { return _mm256_min_pd(x, y); }
+  static reg max(reg x, reg y) noexcept { return _mm256_max_pd(x, y); }
+};
+#elif defined(__SSE2__)
+struct lanes final {
+  using reg = __m128d;
+  static constexpr std::size_t width__{2};
+
+  static reg load(const double *p) noexcept { return _mm_loadu_pd(p); }
+  static void store(double *p, reg x) noexcept { _mm_storeu_pd(p, x); }
+  static reg broadcast(double x) noexcept { return _mm_set1_pd(x); }
+  static reg min(reg x, reg y) noexcept { return _mm_min_pd(x, y); }
+  static reg max(reg x, reg y) noexcept { return _mm_max_pd(x, y); }
+};
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__)
+#define LOX_SIMD
+#endif
+
+// folds x with f, which must take pairs of doubles and of registers alike.
+// the lanes are folded separately and combined at the end, so the result
+// can differ from a left to right fold in the last bits.
+double reduce(const double *x, std::size_t n, double init, auto f) noexcept {
+  std::size_t i{};
+  auto acc{init};
+#ifdef LOX_SIMD
+  if (n >= lanes::width__) {
+    auto r{lanes::load(x)};
+    for (i = lanes::width__; i + lanes::width__ <= n; i += lanes::width__)
+      r = f(r, lanes::load(x + i));
+
+    std::array<double, lanes::width__> parts{};
+    lanes::store(std::data(parts), r);
+    acc = parts[0];
+    for (std::size_t j{1}; j < lanes::width__; ++j)
+      acc = f(acc, parts[j]);
+    acc = f(init, acc);
+  }
+#endif
+  for (; i < n; ++i)
+    acc = f(acc, x[i]);
+  return acc;
+}
+
+// out[i] = f(x[i], y[i]).
+void zip(const double *x, const double *y, double *out, std::size_t n,
+         auto f) noexcept {
+  std::size_t i{};
+#ifdef LOX_SIMD
+  for (; i + lanes::width__ <= n; i += lanes::width__)
+    lanes::store(out + i, f(lanes::load(x + i), lanes::load(y + i)));
+#endif
+  for (; i < n; ++i)
+    out[i] = f(x[i], y[i]);
+}
+
+// out[i] = f(x[i], c).
+void zip(const double *x, double c, double *out, std::size_t n,
+         auto f) noexcept {
+  std::size_t i{};
+#ifdef LOX_SIMD
+  const auto r{lanes::broadcast(c)};
+  for (; i + lanes::width__ <= n; i += lanes::width__)
+    lanes::store(out + i, f(lanes::load(x + i), r));
+#endif
+  for (; i < n; ++i)
+    out[i] = f(x[i], c);
+}
+
+double dot(const double *x, const double *y, std::size_t n) noexcept {
+  std::size_t i{};
+  double acc{};
+#ifdef LOX_SIMD
+  auto r{lanes::broadcast(0)};
+  for (; i + lanes::width__ <= n; i += lanes::width__)
+    r += lanes::load(x + i) * lanes::load(y + i);
+
+  std::array<double, lanes::width__> parts{};
+  lanes::store(std::data(parts), r);
+  for (auto &&p : parts)
+    acc += p;
+#endif
+  for (; i < n; ++i)
+    acc += x[i] * y[i];
+  return acc;
+}
+
+struct plus final {
+  auto operator()(auto x, auto y) const noexcept { return x + y; }
+};
+
+struct minus final {
+  auto operator()(auto x, auto y) const noexcept { return x - y; }
+};
+
+struct times final {
+  auto operator()(auto x, auto y) const noexcept { return x * y; }
+};
+
+struct divides final {
+  auto operator()(auto x, auto y) const noexcept { return x / y; }
+};
+
+struct minimum final {
+  double operator()(double x, double y) const noexcept {
+    return std::min(x, y);
+  }
+#ifdef LOX_SIMD
+  lanes::reg operator()(lanes::reg x, lanes::reg y) const noexcept {
+    return lanes::min(x, y);
+  }
+#endif
+};
+
+struct maximum final {
+  double operator()(double x, double y) const noexcept {
+    return std::max(x, y);
+  }
+#ifdef LOX_SIMD
+  lanes::reg operator()(lanes::reg x, lanes::reg y) const noexcept {
+    return lanes::max(x, y);
+  }
+#endif
+};
+
+// whether x is a whole number in [0, n).
+bool is_index(const value &x, std::size_t n) noexcept {
+  if (!is_number(x))
+    return false;
+  const auto i{std::get<double>(x)};
+  return i >= 0 && i < static_cast<double>(n) && std::trunc(i) == i;
+}
+
+// why k is no index into a sequence.
+expr_error bad_index(const value &k) noexcept {
+  return is_number(k) ? expr_error::out_of_range
+                      : expr_error::invalid_operands;
+}
+
+// a contiguous array of numbers. tasks get their own copy.
+struct f64_array final : object {
+  std::vector<double, tracked<double, subsystem::arrays>> data_{};
+
+  f64_array(std::size_t n) : data_(n) {}
+
+  value index(const value &k) const override {
+    if (!is_index(k, std::size(data_)))
+      return bad_index(k);
+    return data_[std::get<double>(k)];
+  }
+
+  value store(const value &k, value x) override {
+    if (!is_number(x))
+      return expr_error::invalid_operands;
+    if (!is_index(k, std::size(data_)))
+      return bad_index(k);
+    return data_[std::get<double>(k)] = std::get<double>(x);
+  }
+
+  std::ostream &print(std::ostream &os) const override {
+    os << '[';
+    for (std::array<char, 32> buf{}; auto &&x : data_)
+      os << (&x == std::data(data_) ? "" : ", ") << format(x, buf);
+    return os << ']';
+  }
+
+  std::shared_ptr<object> copy(std::shared_ptr<object>,
+                               copier &c) const override {
+    auto &x{c.objects_[this]};
+    if (x == nullptr)
+      x = std::make_shared<f64_array>(*this);
+    return x;
+  }
+};
+
+// a function of one number simple enough to run without the interpreter:
+// its body returns arithmetic on its parameter, on number literals, and on
+// numbers it closes over, which are read once when it is compiled. runs a
+// block of elements through one operation at a time, so every step is a
+// vector kernel.
+class arith final {
+public:
+  static std::optional<arith> compile(const lox_function &f) {
+    const auto &decl{*f.decl_};
+    const auto body{decl.body()};
+    if (std::size(decl.params_) != 1 || body == nullptr ||
+        std::size(body->stmts_) != 1)
+      return std::nullopt;
+
+    const auto ret{dynamic_cast<const return_stmt *>(body->stmts_[0].get())};
+    if (ret == nullptr || ret->value_ == nullptr)
+      return std::nullopt;
+
+    arith a{};
+    if (!a.emit(*ret->value_, decl.param_symbols_[0], *f.closure_))
+      return std::nullopt;
+    return a;
+  }
+
+  void operator()(const double *in, double *out, std::size_t n) const {
+    constexpr std::size_t block{512};
+    std::vector<std::array<double, block>> buffers(depth_);
+    std::vector<operand> stack{};
+
+    for (std::size_t first{}; first < n; first += block) {
+      const auto m{std::min(block, n - first)};
+      stack.clear();
+
+      for (std::size_t i{}; i < std::size(steps_); ++i) {
+        const auto &s{steps_[i]};
+        if (s.op_ == op::param) {
+          stack.push_back({in + first});
+          continue;
+        }
+        if (s.op_ == op::constant) {
+          stack.push_back({nullptr, s.constant_});
+          continue;
+        }
+
+        const auto y{stack.back()};
+        stack.pop_back();
+        const auto x{stack.back()};
+        stack.pop_back();
+
+        // the last step writes straight to the output.
+        const auto dst{i + 1 == std::size(steps_)
+                           ? out + first
+                           : std::data(buffers[std::size(stack)])};
+        apply(s.op_, x, y, dst, m);
+        stack.push_back({dst});
+      }
+
+      const auto result{stack.back()};
+      if (result.data_ == nullptr)
+        std::fill_n(out + first, m, result.constant_);
+      else if (result.data_ != out + first)
+        std::memmove(out + first, result.data_, m * sizeof(double));
+    }
+  }
+
+private:
+  enum struct op { param, constant, add, sub, mul, div };
+
+  struct step final {
+    op op_{};
+    double constant_{};
+  };
+
+  // either a block of values or a constant.
+  struct operand final {
+    const double *data_{};
+    double constant_{};
+  };
+
+  // appends the steps computing e, folding constant subexpressions. returns
+  // false if e is not arithmetic on x and numbers.
+  bool emit(const expr &e, const symbol *x, const env &closure) {
+    if (auto g{dynamic_cast<const grouping_expr *>(&e)})
+      return emit(*g->body_, x, closure);
+
+    if (auto l{dynamic_cast<const literal_expr *>(&e)})
+      return is_number(l->value_) &&
+             push({op::constant, std::get<double>(l->value_)});
+
+    if (auto v{dynamic_cast<const var_expr *>(&e)}) {
+      if (v->symbol_ == x)
+        return push({op::param});
+      for (auto scope{&closure}; scope != nullptr; scope = scope->prev_.get())
+        if (const auto c{scope->symbols_.find(v->symbol_)})
+          return is_number(*c) && push({op::constant, std::get<double>(*c)});
+      return false;
+    }
+
+    if (auto u{dynamic_cast<const unary_expr *>(&e)})
+      // -y is computed as -1 * y, which is exact and, unlike 0 - y, makes
+      // -0 of 0.
+      return u->op_.type_ == token_type::minus__ &&
+             push({op::constant, -1}) && emit(*u->rhs_, x, closure) &&
+             push({op::mul});
+
+    if (auto b{dynamic_cast<const binary_expr *>(&e)}) {
+      const auto o{arithmetic(b->op_.type_)};
+      return o.has_value() && emit(*b->lhs_, x, closure) &&
+             emit(*b->rhs_, x, closure) && push({*o});
+    }
+
+    return false;
+  }
+
+  static std::optional<op> arithmetic(token_type t) noexcept {
+    switch (t) {
+      using enum token_type;
+    default:
+      return std::nullopt;
+    case plus__:
+      return op::add;
+    case minus__:
+      return op::sub;
+    case star__:
+      return op::mul;
+    case slash__:
+      return op::div;
+    }
+  }
+
+  bool push(step s) {
+    if (s.op_ != op::param && s.op_ != op::constant) {
+      const auto n{std::size(steps_)};
+      if (steps_[n - 1].op_ == op::constant &&
+          steps_[n - 2].op_ == op::constant) {
+        const operand x{nullptr, steps_[n - 2].constant_},
+            y{nullptr, steps_[n - 1].constant_};
+        steps_.resize(n - 2);
+        double folded{};
+        apply(s.op_, x, y, &folded, 0);
+        s = {op::constant, folded};
+      }
+    }
+
+    steps_.push_back(s);
+    if (s.op_ == op::param || s.op_ == op::constant)
+      depth_ = std::max(depth_, ++height_);
+    else
+      --height_;
+    return true;
+  }
+
+  static void apply(op o, auto x, auto y, double *out, std::size_t n) {
+    switch (o) {
+    default:
+      return;
+    case op::add:
+      return apply(x, y, out, n, plus{});
+    case op::sub:
+      return apply(x, y, out, n, minus{});
+    case op::mul:
+      return apply(x, y, out, n, times{});
+    case op::div:
+      return apply(x, y, out, n, divides{});
+    }
+  }
+
+  static void apply(auto x, auto y, double *out, std::size_t n, auto f) {
+    if (x.data_ == nullptr && y.data_ == nullptr)
+      *out = f(x.constant_, y.constant_);
+    else if (y.data_ == nullptr)
+      zip(x.data_, y.constant_, out, n, f);
+    else if (x.data_ == nullptr)
+      zip(y.data_, x.constant_, out, n,
+          [&](auto b, auto a) { return f(a, b); });
+    else
+      zip(x.data_, y.data_, out, n, f);
+  }
+
+  std::vector<step> steps_{};
+  // how many operands the steps stack up at most, and right now.
+  std::size_t depth_{}, height_{};
+};
+
+// the array held by x, or null.
+std::shared_ptr<f64_array> to_array(const value &x) {
+  return to_object<f64_array>(x);
+}
+
+// array(n) makes an array of n zeros.
+struct make_array final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (!is_index(args[0], std::numeric_limits<std::uint32_t>::max()))
+      return expr_error::invalid_operands;
+    return std::make_shared<f64_array>(std::get<double>(args[0]));
+  }
+};
+
+// sum(a), min(a) and max(a) fold the elements of a. sum starts from zero;
+// min and max start from the first element, so an empty array is an error.
+template <typename F, bool from_zero> struct array_fold final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto a{to_array(args[0])};
+    if (a == nullptr || (!from_zero && a->data_.empty()))
+      return expr_error::invalid_operands;
+
+    const auto &x{a->data_};
+    return from_zero ? reduce(std::data(x), std::size(x), 0, F{})
+                     : reduce(std::data(x) + 1, std::size(x) - 1, x[0], F{});
+  }
+};
+
+using array_sum = array_fold<plus, true>;
+using array_min = array_fold<minimum, false>;
+using array_max = array_fold<maximum, false>;
+
+// dot(a, b) is the dot product of two arrays of the same length.
+struct array_dot final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto a{to_array(args[0])}, b{to_array(args[1])};
+    if (a == nullptr || b == nullptr ||
+        std::size(a->data_) != std::size(b->data_))
+      return expr_error::invalid_operands;
+    return dot(std::data(a->data_), std::data(b->data_),
+               std::size(a->data_));
+  }
+};
+
+// add(a, b) is a new array of the sums of the elements of a and b.
+struct array_add final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto a{to_array(args[0])}, b{to_array(args[1])};
+    if (a == nullptr || b == nullptr ||
+        std::size(a->data_) != std::size(b->data_))
+      return expr_error::invalid_operands;
+
+    auto c{std::make_shared<f64_array>(std::size(a->data_))};
+    zip(std::data(a->data_), std::data(b->data_), std::data(c->data_),
+        std::size(c->data_), plus{});
+    return c;
+  }
+};
+
+// scale(a, k) is a new array of the elements of a times k.
+struct array_scale final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto a{to_array(args[0])};
+    if (a == nullptr || !is_number(args[1]))
+      return expr_error::invalid_operands;
+
+    auto c{std::make_shared<f64_array>(std::size(a->data_))};
+    zip(std::data(a->data_), std::get<double>(args[1]), std::data(c->data_),
+        std::size(c->data_), times{});
+    return c;
+  }
+};
+
+// map(a, f) is a new array of f applied to each element of a. f runs as a
+// vector kernel when it compiles to one, and is called per element
+// otherwise.
+struct array_map final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto a{to_array(args[0])};
+    const auto f{to_function(args[1])};
+    if (a == nullptr || f == nullptr)
+      return expr_error::invalid_operands;
+
+    auto c{std::make_shared<f64_array>(std::size(a->data_))};
+
+    if (const auto lox{dynamic_cast<const lox_function *>(f.get())})
+      if (const auto kernel{arith::compile(*lox)}) {
+        (*kernel)(std::data(a->data_), std::data(c->data_),
+                  std::size(c->data_));
+        return c;
+      }
+
+    for (std::size_t i{}; i < std::size(a->data_); ++i) {
+      const auto x{f->call({a->data_[i]})};
+      if (!is_number(x))
+        return is_error(x) ? x : expr_error::invalid_operands;
+      c->data_[i] = std::get<double>(x);
+    }
+    return c;
+  }
+};
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "document.h"
+#include "session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// keeps the optimizer from dropping the work being timed.
+volatile double sink__{};
+
+// runs f, which does ops operations, and prints the time each one took.
+void bench(std::string_view name, std::size_t ops, auto &&f) {
+  const auto start{std::chrono::steady_clock::now()};
+  f();
+  const std::chrono::duration<double, std::nano> elapsed{
+      std::chrono::steady_clock::now() - start};
+
+  std::cout << std::left << std::setw(44) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(2)
+            << elapsed.count() / ops << " ns/op" << std::endl;
+}
+
+// the global scope as it was, a node based map keyed by name, against the
+// symbol table, looking up, declaring and erasing n globals.
+void globals(std::size_t n) {
+  constexpr std::size_t lookups{1 << 22};
+
+  std::vector<std::string> names(n);
+  std::vector<const symbol *> symbols(n);
+  for (std::size_t i{}; i < n; ++i) {
+    names[i] = "global" + std::to_string(i);
+    symbols[i] = symbol::intern(names[i]);
+  }
+
+  std::mt19937 random{n};
+  std::vector<std::size_t> order(lookups);
+  for (auto &&x : order)
+    x = std::uniform_int_distribution<std::size_t>{0, n - 1}(random);
+
+  const auto label{[&](std::string_view what) {
+    return std::string{what} + " n=" + std::to_string(n);
+  }};
+
+  std::unordered_map<std::string, value> map{};
+  bench(label("map declare"), n, [&] {
+    for (auto &&x : names)
+      if (!map.contains(x))
+        map[x] = 1.0;
+  });
+  bench(label("map lookup"), lookups, [&] {
+    double sum{};
+    for (auto i : order)
+      if (map.contains(names[i]))
+        sum += std::get<double>(map[names[i]]);
+    sink__ = sum;
+  });
+  bench(label("map erase"), n, [&] {
+    for (auto &&x : names)
+      map.erase(x);
+  });
+
+  symbol_table<value> table{};
+  bench(label("symbol_table declare"), n, [&] {
+    for (auto x : symbols)
+      if (!table.contains(x))
+        table[x] = 1.0;
+  });
+  bench(label("symbol_table lookup"), lookups, [&] {
+    double sum{};
+    for (auto i : order)
+      if (const auto x{table.find(symbols[i])})
+        sum += std::get<double>(*x);
+    sink__ = sum;
+  });
+  bench(label("symbol_table erase"), n, [&] {
+    for (auto x : symbols)
+      table.erase(x);
+  });
+}
+
+// n random positions below n, at least enough to time reliably.
+std::vector<std::size_t> positions(std::size_t n) {
+  std::mt19937 random{n};
+  std::vector<std::size_t> out(std::max<std::size_t>(n, 1 << 20));
+  for (auto &&x : out)
+    x = std::uniform_int_distribution<std::size_t>{0, n - 1}(random);
+  return out;
+}
+
+// a list of n numbers: appending them, reading them back in a random order
+// through the same path as l[i], and walking them.
+void lists(std::size_t n) {
+  const auto order{positions(n)};
+  const auto label{[&](std::string_view what) {
+    return "lox_list " + std::string{what} + " n=" + std::to_string(n);
+  }};
+
+  lox_list l{};
+  bench(label("push"), n, [&] {
+    for (std::size_t i{}; i < n; ++i)
+      l.items_.push_back(static_cast<double>(i));
+  });
+  bench(label("index"), std::size(order), [&] {
+    double sum{};
+    for (auto i : order)
+      sum += std::get<double>(l.index(static_cast<double>(i)));
+    sink__ = sum;
+  });
+  bench(label("iterate"), n, [&] {
+    double sum{};
+    for (auto &&x : l.items_)
+      sum += std::get<double>(x);
+    sink__ = sum;
+  });
+}
+
+// the map against a node based one, inserting keys, looking them up in a
+// random order, walking the entries and erasing them.
+void maps(std::string_view kind, const std::vector<value> &keys) {
+  const auto n{std::size(keys)};
+  const auto order{positions(n)};
+  const auto label{[&](std::string_view map, std::string_view what) {
+    return std::string{map} + "<" + std::string{kind} + "> " +
+           std::string{what} + " n=" + std::to_string(n);
+  }};
+
+  {
+    lox_map m{};
+    bench(label("lox_map", "insert"), n, [&] {
+      for (std::size_t i{}; i < n; ++i)
+        m[keys[i]] = static_cast<double>(i);
+    });
+    bench(label("lox_map", "lookup"), std::size(order), [&] {
+      double sum{};
+      for (auto i : order)
+        sum += std::get<double>(*m.find(keys[i]));
+      sink__ = sum;
+    });
+    bench(label("lox_map", "iterate"), n, [&] {
+      double sum{};
+      m.for_each([&](const value &, const value &v) {
+        sum += std::get<double>(v);
+      });
+      sink__ = sum;
+    });
+    bench(label("lox_map", "erase"), n, [&] {
+      for (auto &&x : keys)
+        m.erase(x);
+    });
+  }
+
+  std::unordered_map<value, value> m{};
+  bench(label("unordered_map", "insert"), n, [&] {
+    for (std::size_t i{}; i < n; ++i)
+      m[keys[i]] = static_cast<double>(i);
+  });
+  bench(label("unordered_map", "lookup"), std::size(order), [&] {
+    double sum{};
+    for (auto i : order)
+      sum += std::get<double>(m.find(keys[i])->second);
+    sink__ = sum;
+  });
+  bench(label("unordered_map", "iterate"), n, [&] {
+    double sum{};
+    for (auto &&[_, v] : m)
+      sum += std::get<double>(v);
+    sink__ = sum;
+  });
+  bench(label("unordered_map", "erase"), n, [&] {
+    for (auto &&x : keys)
+      m.erase(x);
+  });
+}
+
+// what metering costs: a tick on its own, then loops and calls run with
+// neither limit, with fuel, and with a deadline. none of the limits are
+// reached.
+void metering() {
+  constexpr std::size_t ticks{1 << 26};
+  charge_to(std::make_shared<budget>());
+  bench("tick", ticks, [&] {
+    std::size_t stops{};
+    for (std::size_t i{}; i < ticks; ++i)
+      stops += tick();
+    sink__ = stops;
+  });
+  charge_to(nullptr);
+
+  constexpr std::size_t iterations{3000000}, calls{242785};
+  const auto loop{"var i = 0; while (i < 3000000) i = i + 1;"};
+  const auto fib{"fun fib(n) { if (n < 2) return n;"
+                 " return fib(n - 1) + fib(n - 2); } fib(25);"};
+
+  for (auto [name, fuel, limit] :
+       {std::tuple{"unmetered", std::uint64_t{}, 0},
+        std::tuple{"fuel", std::uint64_t{1} << 40, 0},
+        std::tuple{"deadline", std::uint64_t{}, 1 << 20}}) {
+    max_fuel__ = fuel;
+    time_limit__ = std::chrono::milliseconds{limit};
+    bench(std::string{"loop iteration "} + name, iterations,
+          [&] { session{}.eval(loop); });
+    bench(std::string{"call "} + name, calls, [&] { session{}.eval(fib); });
+  }
+  max_fuel__ = 0;
+  time_limit__ = {};
+}
+
+// editing a file of 50k lines: lexing and parsing all of it, as every
+// keystroke did, against a document relexing and reparsing what each edit
+// touches. an edit types a letter into a name and takes it out again, or
+// deletes a semicolon and puts it back, in a random function.
+void reparsing() {
+  constexpr std::size_t functions{5000}, edits{1000};
+
+  std::string source{};
+  std::vector<std::size_t> names{};
+  for (std::size_t i{}; i < functions; ++i) {
+    std::string name{"fn"};
+    for (auto j{i}; j != 0; j /= 26)
+      name += static_cast<char>('a' + j % 26);
+    source += "fun " + name + "(a, b) {\n  var x";
+    names.push_back(std::size(source));
+    source += " = a;\n  while (x < b) {\n    x = x + 1;\n  }\n"
+              "  if (x > b) print x;\n  else print b;\n  return x;\n}\n"
+              "print " +
+              name + "(1, 2);\n";
+  }
+
+  bench("lex and parse 50k lines", 1, [&] {
+    lexer l{source};
+    parser p{l.scan()};
+    sink__ = std::size(p.make_ast());
+  });
+
+  std::unique_ptr<document> d{};
+  bench("open a document of 50k lines", 1,
+        [&] { d = std::make_unique<document>(source); });
+
+  std::mt19937 random{functions};
+  std::vector<std::size_t> order(edits);
+  for (auto &&x : order)
+    x = names[std::uniform_int_distribution<std::size_t>{
+        0, functions - 1}(random)];
+
+  bench("edit a name", edits * 2, [&] {
+    std::size_t reparsed{};
+    for (auto x : order) {
+      d->edit(x, 0, "y");
+      reparsed += d->reparsed();
+      d->edit(x, 1, "");
+      reparsed += d->reparsed();
+    }
+    sink__ = reparsed;
+  });
+  bench("break and fix a statement", edits * 2, [&] {
+    std::size_t reparsed{};
+    for (auto x : order) {
+      d->edit(x + 4, 1, "");
+      reparsed += d->reparsed();
+      d->edit(x + 4, 0, ";");
+      reparsed += d->reparsed();
+    }
+    sink__ = reparsed;
+  });
+}
+
+// a library of functions of which a run calls only a few: parsing it with
+// every body, against leaving each body until its first call, and the trees
+// and tokens kept after parsing and after the run. memory is only counted
+// right if tracking is on before anything is allocated, so each way runs in
+// a process of its own, started with --lazy-parsing=eager or =lazy.
+void lazy_parsing(bool lazy) {
+  constexpr std::size_t functions{2000}, called{20};
+
+  std::string source{};
+  std::vector<std::string> names{};
+  for (std::size_t i{}; i < functions; ++i) {
+    std::string name{"fn"};
+    for (auto j{i}; j != 0; j /= 26)
+      name += static_cast<char>('a' + j % 26);
+    source += "fun " + name +
+              "(n) {\n  var s = 0;\n  var i = 0;\n  while (i < n) {\n"
+              "    if (i / 2 == 0) s = s + i * 3;\n"
+              "    else s = s - [i, 1][1];\n    i = i + 1;\n  }\n"
+              "  return s;\n}\n";
+    names.push_back(std::move(name));
+  }
+  for (std::size_t i{}; i < called; ++i)
+    source += names[i * functions / called] + "(10);\n";
+
+  const auto kept{[] {
+    return memory::of(subsystem::ast).live_ +
+           memory::of(subsystem::tokens).live_;
+  }};
+
+  lazy_parse__ = lazy;
+  const std::string how{lazy ? " lazily" : " eagerly"};
+  const auto before{kept()};
+
+  {
+    std::vector<std::unique_ptr<stmt>> stmts{};
+    bench("parse library" + how, 1, [&] {
+      lexer l{source};
+      parser p{l.scan()};
+      stmts = p.make_ast();
+    });
+    const auto parsed{kept() - before};
+
+    session s{};
+    bench("run library" + how, 1, [&] { s.exec(stmts); });
+
+    // lexemes are not counted, see report_memory.
+    std::cout << "  trees and token lists kept: " << parsed / 1024
+              << " KiB parsed, " << (kept() - before) / 1024
+              << " KiB after the run" << std::endl;
+  }
+
+  // everything counted is released again.
+  std::cout << "  left once freed: " << kept() - before << " bytes"
+            << std::endl;
+}
+
+// a loop doing little but call small functions, with calls made as calls,
+// inlined, and inlined then deoptimized by redefining one of the functions.
+void inlining() {
+  // each iteration makes four calls.
+  constexpr std::size_t calls{4000000};
+  const auto library{"fun add(a, b) { return a + b; }"
+                     " fun sq(x) { return x * x; }"
+                     " fun run(n) { var s = 0; var i = 0;"
+                     " while (i < n) { s = add(s, sq(i) - add(i, 1));"
+                     " i = add(i, 1); } return s; }"};
+  const auto loop{"run(1000000);"};
+
+  for (auto [name, budget] : {std::pair{"made", std::size_t{}},
+                              std::pair{"inlined", std::size_t{16}}}) {
+    inline_budget__ = budget;
+    session s{};
+    s.eval(library);
+    bench(std::string{"small call "} + name, calls, [&] { s.eval(loop); });
+    if (budget != 0) {
+      s.eval("fun add(a, b) { return b + a; }");
+      bench("small call deoptimized", calls, [&] { s.eval(loop); });
+    }
+  }
+  inline_budget__ = 16;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && std::string_view{argv[1]}.starts_with("--lazy-parsing=")) {
+    mem_tracking__ = true;
+    lazy_parsing(std::string_view{argv[1]} == "--lazy-parsing=lazy");
+    return 0;
+  }
+
+  inlining();
+  std::cout << std::flush;
+  for (auto how : {"eager", "lazy"})
+    std::system((std::string{argv[0]} + " --lazy-parsing=" + how).c_str());
+  reparsing();
+  metering();
+
+  for (auto n : {10, 1000, 100000})
+    globals(n);
+
+  for (std::size_t n : {1000, 100000, 10000000}) {
+    lists(n);
+
+    std::vector<value> keys(n);
+    for (std::size_t i{}; i < n; ++i)
+      keys[i] = static_cast<double>(i);
+    maps("number", keys);
+
+    for (std::size_t i{}; i < n; ++i)
+      keys[i] = lox_string{"key" + std::to_string(i)};
+    maps("string", keys);
+  }
+}
\ No newline at end of file
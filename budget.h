@@ -0,0 +1,120 @@
+#pragma once
+
+#include "env.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <variant>
+
+// loop iterations and calls a run may make, zero for no limit. set with
+// --fuel.
+std::uint64_t max_fuel__{};
+
+// how long a run may take, zero for no limit. set with --time-limit.
+std::chrono::milliseconds time_limit__{};
+
+// what one run of a program may spend: fuel, burnt one unit per loop
+// iteration and call, and time. the host can also interrupt it from any
+// thread. the threads running the program take fuel in grants and count
+// each grant down in a thread-local, so the shared state, the clock and the
+// interrupt flag are only looked at once per grant. threads blocked waiting
+// look at the clock and the flag while they wait.
+class budget final {
+public:
+  static constexpr std::uint64_t grant__{1024};
+
+  // refills the fuel and sets the deadline for a new run. an interrupt that
+  // has yet to be taken is kept, and stops the new run. tasks spawned by
+  // earlier runs may be spending the budget meanwhile, so all of it is
+  // atomic; they go on under the new run's limits.
+  void start(std::uint64_t fuel, std::chrono::milliseconds limit) noexcept {
+    using clock = std::chrono::steady_clock;
+    const auto deadline{limit.count() == 0 ? clock::time_point::max()
+                                           : clock::now() + limit};
+    metered_.store(fuel != 0, std::memory_order_relaxed);
+    fuel_.store(fuel, std::memory_order_relaxed);
+    deadline_.store(deadline.time_since_epoch().count(),
+                    std::memory_order_relaxed);
+    stopped_.store(false, std::memory_order_relaxed);
+  }
+
+  // stops the run in progress at its next loop iteration or call, or the
+  // next run if none is in progress.
+  void interrupt() noexcept {
+    interrupted_.store(true, std::memory_order_relaxed);
+  }
+
+  // stops every run from now on, like an interrupt that is never cleared.
+  void cancel() noexcept { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // counts the tasks spending the budget that have yet to finish.
+  void enter() noexcept { ++tasks_; }
+
+  void leave() noexcept {
+    if (--tasks_ == 0)
+      tasks_.notify_all();
+  }
+
+  // waits until every task spending the budget has finished.
+  void wait() const noexcept {
+    for (auto n{tasks_.load()}; n != 0; n = tasks_.load())
+      tasks_.wait(n);
+  }
+
+  // why the run must stop whatever fuel is left, if it must. taking an
+  // interrupt clears it and stops the rest of the run on every thread.
+  std::optional<expr_error> stop() noexcept {
+    if (cancelled_.load(std::memory_order_relaxed))
+      return expr_error::interrupted;
+    if (interrupted_.exchange(false, std::memory_order_relaxed))
+      stopped_.store(true, std::memory_order_relaxed);
+    if (stopped_.load(std::memory_order_relaxed))
+      return expr_error::interrupted;
+    if (std::chrono::steady_clock::now().time_since_epoch().count() >=
+        deadline_.load(std::memory_order_relaxed))
+      return expr_error::time_limit;
+    return std::nullopt;
+  }
+
+  // the next grant of fuel, or why the run must stop instead.
+  std::variant<std::uint64_t, expr_error> take() noexcept {
+    if (const auto e{stop()})
+      return *e;
+    if (!metered_.load(std::memory_order_relaxed))
+      return grant__;
+
+    auto left{fuel_.load(std::memory_order_relaxed)};
+    for (; left != 0 && !fuel_.compare_exchange_weak(
+                            left, left - std::min(left, grant__),
+                            std::memory_order_relaxed);)
+      ;
+    if (left == 0)
+      return expr_error::out_of_fuel;
+    return std::min(left, grant__);
+  }
+
+private:
+  std::atomic<bool> metered_{};
+  std::atomic<std::uint64_t> fuel_{};
+  // in ticks of the steady clock.
+  std::atomic<std::chrono::steady_clock::rep> deadline_{
+      std::chrono::steady_clock::time_point::max().time_since_epoch().count()};
+  std::atomic<bool> interrupted_{}, stopped_{}, cancelled_{};
+  std::atomic<std::size_t> tasks_{};
+};
+
+// the budget the code running on this thread spends, if any.
+thread_local std::shared_ptr<budget> budget__{};
+
+// what is left of this thread's grant.
+thread_local std::uint64_t ticks__{};
+
+// charges this thread to b from now on.
+void charge_to(std::shared_ptr<budget> b) noexcept {
+  budget__ = std::move(b);
+  ticks__ = 0;
+}
\ No newline at end of file
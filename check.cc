@@ -0,0 +1,357 @@
+#include "collection.h"
+#include "document.h"
+#include "output.h"
+#include "session.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+
+// checks for what a program's output can't show, such as whether an
+// optimization took. exits with the number of checks that failed.
+int failures__{};
+
+void check(bool ok, std::string_view what) {
+  if (!ok) {
+    std::cerr << "failed: " << what << std::endl;
+    ++failures__;
+  }
+}
+
+// what source prints when run in a session of its own.
+std::string run(std::string source) {
+  output o{};
+  out__ = &o;
+  session{}.eval(std::move(source));
+  out__ = &standard_output();
+  return o.take();
+}
+
+// the first loop in s, outside any function.
+const while_stmt *find_loop(const stmt &s) {
+  if (auto x{dynamic_cast<const while_stmt *>(&s)})
+    return x;
+  if (auto x{dynamic_cast<const block_stmt *>(&s)})
+    for (auto &&y : x->stmts_)
+      if (auto w{find_loop(*y)})
+        return w;
+  return nullptr;
+}
+
+// a counted for loop runs on an unboxed counter, and still counts right.
+void counted_loops() {
+  const auto source{"var s = 0;"
+                    " for (var i = 0; i < 10; i = i + 1) s = s + i;"
+                    " print s;"};
+  lexer l{source};
+  parser p{l.scan()};
+  const auto stmts{p.make_ast()};
+  optimize(stmts);
+
+  const auto w{find_loop(*stmts[1])};
+  check(w != nullptr && w->counter_.has_value() && w->counter_->fixed_ &&
+            w->counter_->step_ == 1,
+        "for loop gets a counter");
+  check(run(source) == "45\n", "counted loop sums 0 to 9");
+
+  // a body that declares keeps its scope, and so its counter boxed.
+  check(run("for (var i = 0; i < 3; i = i + 1) { var j = i; print j; }") ==
+            "0\n1\n2\n",
+        "loop with a scoped body counts");
+}
+
+// an interrupt that comes in before a run stops it, and only it. one that
+// comes in while the run waits on a channel stops it too.
+void interrupts() {
+  output o{};
+  out__ = &o;
+  session s{};
+
+  s.interrupt();
+  check(!s.eval("fun f() { print 1; } f();"), "early interrupt stops a run");
+  check(s.eval("f();"), "interrupt is used up");
+
+  std::jthread host{[&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    s.interrupt();
+  }};
+  check(!s.eval("recv(chan(1));"), "interrupt stops a blocked recv");
+
+  out__ = &standard_output();
+  check(o.take() == "1\n", "interrupted runs print nothing");
+}
+
+// a program that runs out of fuel in an i/o callback stops there, rather
+// than waiting on a server no one dials, and drops the server.
+void stopped_io() {
+  output o{};
+  out__ = &o;
+  session s{};
+
+  max_fuel__ = 1000;
+  check(!s.eval("fun spin(x) { for (;;) {} } fun echo(x) { return x; }"
+                " serve(47321, 1, echo); read(\"/dev/null\", spin);"),
+        "callback runs out of fuel");
+  max_fuel__ = 0;
+  check(s.eval("print 1;"), "next program runs");
+
+  out__ = &standard_output();
+  check(o.take() == "1\n", "nothing else runs");
+}
+
+// a unit's tokens placed in the file, whether it parsed, and what it
+// reported, one entry per unit.
+auto layout(const document &d) {
+  std::vector<std::tuple<token_type, std::string, std::size_t, int, bool,
+                         std::string>>
+      x{};
+  for (auto &&u : d.units())
+    for (auto &&t : u.tokens_)
+      x.emplace_back(t.type_, t.lexeme_, u.begin_ + t.offset_,
+                     u.line_ + t.line_, u.stmt_ != nullptr, u.diagnostics_);
+  return x;
+}
+
+// random edits of random fragments leave a document as it would be parsed
+// from scratch. a character no token starts with is reported, not thrown.
+void document_edits() {
+  document typo{"var x = 1;\nprint x;\n"};
+  typo.edit(8, 1, "#");
+  check(typo.units().front().stmt_ == nullptr &&
+            typo.units().front().diagnostics_ ==
+                "unexpected character '#'.\n",
+        "stray character is a syntax error");
+
+  constexpr std::string_view fragments[]{
+      "var ", "fun ",  "f",      "{",     "}",       "(",      ")",
+      ";",    "x",     " ",      "\n",    "\"",      "=",      "1",
+      "if ",  "else ", "print ", ",",     "!",       "[",      "]",
+      "#",    "%",     "return ", "while "};
+
+  std::string base{};
+  for (char c{'a'}; c <= 'z'; ++c)
+    base += std::string{"fun f"} + c +
+            "(a) {\n  var x = a;\n  if (x) print x; else print 1;\n"
+            "  return x;\n}\nprint 2;\n";
+
+  for (unsigned seed{1}; seed <= 3; ++seed) {
+    std::mt19937 random{seed};
+    document d{base};
+    for (int i{}; i < 5000; ++i) {
+      if (i % 500 == 0)
+        d = document{base};
+
+      const auto offset{random() % (std::size(d.text()) + 1)};
+      const auto count{random() % 4 == 0 ? random() % 6 : 0};
+      std::string text{};
+      for (auto n{random() % 3}; n != 0; --n)
+        text += fragments[random() % std::size(fragments)];
+      d.edit(offset, count, text);
+
+      if (layout(d) != layout(document{d.text()})) {
+        check(false, "edited document parses as if fresh, seed " +
+                         std::to_string(seed) + " edit " +
+                         std::to_string(i));
+        break;
+      }
+    }
+  }
+}
+
+// a call in return position stays a tail call when it is inlined, and
+// when the inlined site deoptimizes.
+void inlined_tail_calls() {
+  const std::string source{
+      "fun loop(n) { if (n == 0) return 0; return step(n); }"
+      " fun step(n) { return loop(n - 1); }"
+      " print loop(100000);"};
+  check(run(source) == "0\n", "inlined tail call keeps its frame");
+  check(run(source + " fun other(n) { return loop(n - 1); }"
+                     " step = other; print loop(100000);") == "0\n0\n",
+        "deoptimized tail call keeps its frame");
+}
+
+// only pure functions are memoized: one reading a global sees it change, and
+// one printing, or calling one that prints, prints on every call.
+void memoized_calls() {
+  memoize__ = true;
+  output o{};
+  out__ = &o;
+  session s{};
+  s.eval("var base = 1;"
+         " fun square(x) { return x * x; }"
+         " fun scaled(x) { return x * base; }"
+         " fun noisy(x) { print x; return x; }"
+         " fun calls(x) { return noisy(x) + 1; }"
+         " print square(3) + square(3);"
+         " print scaled(2); base = 10; print scaled(2);"
+         " noisy(4); noisy(4); print calls(5); print calls(5);");
+  out__ = &standard_output();
+  memoize__ = false;
+
+  check(o.take() == "18\n2\n20\n4\n4\n5\n6\n5\n6\n",
+        "impure functions run on every call");
+  const auto &pure{s.memoized()};
+  check(std::size(pure) == 1 && pure.contains("square") &&
+            pure.at("square")->memo_->hits() == 1,
+        "only the pure function is memoized");
+}
+
+// a program prints the same whether function bodies are parsed up front or
+// on their first call, including bodies nested in bodies and bodies never
+// called.
+void lazy_parsing() {
+  const std::string source{
+      "var total = 0;"
+      " fun adder(n) { fun add(x) { total = total + x; return x + n; }"
+      " return add; }"
+      " fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+      " fun unused() { print \"{ never  run }\"; }"
+      " fun show(s) { var t = \"a  {b}  \" + s; print t; }"
+      " var addtwo = adder(2); print addtwo(5); print addtwo(fib(15));"
+      " print total; show(\"c\"); print adder(1)(1);"};
+
+  const auto eager{run(source)};
+  lazy_parse__ = true;
+  const auto lazy{run(source)};
+  lazy_parse__ = false;
+  check(eager == "7\n612\n615\na  {b}  c\n2\n", "eager parse runs right");
+  check(lazy == eager, "lazy parse runs as eager parse does");
+}
+
+// map runs a function it compiles to a vector kernel to the same numbers,
+// -0 included, as calling it on each element does.
+void map_kernels() {
+  session s{};
+  s.eval("var k = 3; var a = array(9); var b = array(9);"
+         " for (var i = 0; i < 9; i = i + 1) a[i] = (i - 4) / 2;"
+         " fun neg(x) { return -x; }"
+         " fun poly(x) { return (x - k) * -(x + 1) / 2; }"
+         " fun inv(x) { return 1 / -x; }");
+
+  for (std::string f : {"neg", "poly", "inv"}) {
+    const auto x{s.globals()->symbols_.find(symbol::intern(f))};
+    const auto lox{x == nullptr ? nullptr : to_object<lox_function>(*x)};
+    check(lox != nullptr && arith::compile(*lox).has_value(),
+          f + " compiles to a kernel");
+
+    output o{};
+    out__ = &o;
+    s.eval("print map(a, " + f + ");");
+    const auto kernel{o.take()};
+    s.eval("for (var i = 0; i < 9; i = i + 1) b[i] = " + f +
+           "(a[i]); print b;");
+    out__ = &standard_output();
+    check(kernel == o.take(), f + " maps as it calls");
+  }
+}
+
+// random inserts and erases, of keys whose probe runs collide, leave a map
+// holding what a reference map holds.
+void map_erasure() {
+  std::vector<value> keys{};
+  for (int i{}; i < 48; ++i) {
+    keys.push_back(static_cast<double>(i));
+    keys.push_back(lox_string{"k" + std::to_string(i)});
+  }
+
+  for (unsigned seed{1}; seed <= 3; ++seed) {
+    std::mt19937 random{seed};
+    lox_map m{};
+    std::map<std::size_t, double> reference{};
+    for (int i{}; i < 20000; ++i) {
+      const auto k{random() % std::size(keys)};
+      if (random() % 2 == 0) {
+        m[keys[k]] = static_cast<double>(i);
+        reference[k] = i;
+      } else if (m.erase(keys[k]) != (reference.erase(k) == 1)) {
+        check(false, "map erases what is there, seed " +
+                         std::to_string(seed) + " op " + std::to_string(i));
+        break;
+      }
+
+      auto same{m.size() == std::size(reference)};
+      for (std::size_t j{}; j < std::size(keys) && same; ++j) {
+        const auto x{m.find(keys[j])};
+        const auto y{reference.find(j)};
+        same = y == std::end(reference)
+                   ? x == nullptr
+                   : x != nullptr && *x == value{y->second};
+      }
+      if (!same) {
+        check(false, "map holds what the reference does, seed " +
+                         std::to_string(seed) + " op " + std::to_string(i));
+        break;
+      }
+    }
+  }
+}
+
+// globals saved after a prelude load back into a session that then runs as
+// if it had run the prelude itself; an image in which a scope is its own
+// parent is refused.
+void snapshots() {
+  const std::string prelude{
+      "fun counter() { var n = 0; fun next() { n = n + 1; return n; }"
+      " return next; }"
+      " var tick = counter(); tick();"
+      " var xs = [1, \"two\", true]; var m = [\"a\": xs, 2: 3];"
+      " var a = array(3); a[1] = 2.5;"},
+      script{"print tick(); print xs[1]; print len(m[\"a\"]); print m[2];"
+             " print sum(a);"};
+  const auto path{
+      (std::filesystem::temp_directory_path() / "check.snap").string()};
+
+  session s{};
+  token_list tokens{};
+  check(s.eval(prelude, &tokens) && save_snapshot(path, s, tokens),
+        "snapshot saved");
+
+  const auto resumed{[&] {
+    output o{};
+    out__ = &o;
+    session t{};
+    const auto ok{load_snapshot(path, t) && t.eval(script)};
+    out__ = &standard_output();
+    return std::tuple{ok, o.take()};
+  }};
+  check(resumed() == std::tuple{true, run(prelude + script)},
+        "snapshot resumes the prelude");
+
+  // the closure's scope is numbered 1, after the globals; make its parent
+  // itself.
+  std::ifstream f{path};
+  std::string image{std::istreambuf_iterator{f},
+                    std::istreambuf_iterator<char>{}};
+  const auto at{std::min(image.rfind(std::string{"\1\0\0\0n", 5}),
+                         image.rfind(std::string{"\4\0\0\0next", 8})) -
+                16};
+  check(image[at] == 1, "closure scope's parent is the globals");
+  image[at] = 2;
+  std::ofstream{path} << image;
+  check(!std::get<0>(resumed()), "snapshot with a looping scope refused");
+  std::filesystem::remove(path);
+}
+
+int main() {
+  counted_loops();
+  interrupts();
+  stopped_io();
+  document_edits();
+  inlined_tail_calls();
+  memoized_calls();
+  lazy_parsing();
+  map_kernels();
+  map_erasure();
+  snapshots();
+  return failures__;
+}
\ No newline at end of file
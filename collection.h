@@ -0,0 +1,390 @@
+#pragma once
+
+#include "array.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// writes x as it appears inside a list or map, with strings quoted.
+std::ostream &print_element(std::ostream &os, const value &x) {
+  return is_string(x) ? os << '"' << std::get<lox_string>(x) << '"'
+                      : os << x;
+}
+
+// a growable list of values. tasks get their own copy.
+struct lox_list final : object {
+  std::vector<value, tracked<value, subsystem::collections>> items_{};
+
+  value index(const value &k) const override {
+    if (!is_index(k, std::size(items_)))
+      return bad_index(k);
+    return items_[std::get<double>(k)];
+  }
+
+  value store(const value &k, value x) override {
+    if (!is_index(k, std::size(items_)))
+      return bad_index(k);
+    return items_[std::get<double>(k)] = std::move(x);
+  }
+
+  std::ostream &print(std::ostream &os) const override {
+    // a list holding itself prints as [...] the second time round.
+    if (printing_)
+      return os << "[...]";
+    printing_ = true;
+    os << '[';
+    for (auto &&x : items_)
+      print_element(os << (&x == std::data(items_) ? "" : ", "), x);
+    printing_ = false;
+    return os << ']';
+  }
+
+  std::shared_ptr<object> copy(std::shared_ptr<object>,
+                               copier &c) const override {
+    auto &x{c.objects_[this]};
+    if (x != nullptr)
+      return x;
+
+    // registered before the items are copied, so cycles close on the copy.
+    auto l{std::make_shared<lox_list>()};
+    x = l;
+    l->items_.reserve(std::size(items_));
+    for (auto &&y : items_)
+      l->items_.push_back(c(y));
+    return l;
+  }
+
+private:
+  mutable bool printing_{};
+};
+
+// a map from numbers and strings to values. the entries sit contiguously in
+// insertion order, so walking them touches nothing else; a table of 32-bit
+// slots, probed linearly and kept at most half full, finds them by key.
+// erasing moves the last entry into the hole, so the order only holds until
+// something is erased. pointers to values are invalidated by insertion and
+// erasure.
+class lox_map final : public object {
+public:
+  // whether k can be a key: a string, or a number other than nan.
+  static bool is_key(const value &k) noexcept {
+    return is_string(k) || (is_number(k) && !std::isnan(std::get<double>(k)));
+  }
+
+  value *find(const value &k) noexcept {
+    if (entries_.empty())
+      return nullptr;
+    const auto s{slots_[probe(k, hash(k))]};
+    return s == 0 ? nullptr : &entries_[s - 1].value_;
+  }
+
+  const value *find(const value &k) const noexcept {
+    return const_cast<lox_map *>(this)->find(k);
+  }
+
+  // the value at k, inserting nil if there is none. k must be a key.
+  value &operator[](const value &k) {
+    const auto h{hash(k)};
+    if (!entries_.empty())
+      if (const auto s{slots_[probe(k, h)]}; s != 0)
+        return entries_[s - 1].value_;
+
+    if ((std::size(entries_) + 1) * 2 > std::size(slots_))
+      rehash(std::max<std::size_t>(8, std::size(slots_) * 2));
+    entries_.push_back({k, {}, h});
+    slots_[probe(k, h)] = std::size(entries_);
+    return entries_.back().value_;
+  }
+
+  bool erase(const value &k) noexcept {
+    if (entries_.empty())
+      return false;
+
+    const auto mask{std::size(slots_) - 1};
+    auto i{probe(k, hash(k))};
+    const auto s{slots_[i]};
+    if (s == 0)
+      return false;
+
+    // close the hole by pulling back each later slot of the run whose home
+    // is not between the hole and the slot itself.
+    for (auto j{(i + 1) & mask}; slots_[j] != 0; j = (j + 1) & mask) {
+      const auto home{entries_[slots_[j] - 1].hash_ & mask};
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+    slots_[i] = 0;
+
+    // move the last entry into the erased one's place.
+    if (const auto last{std::size(entries_)}; s != last) {
+      auto j{entries_.back().hash_ & mask};
+      for (; slots_[j] != last; j = (j + 1) & mask)
+        ;
+      slots_[j] = s;
+      entries_[s - 1] = std::move(entries_.back());
+    }
+    entries_.pop_back();
+    return true;
+  }
+
+  std::size_t size() const noexcept { return std::size(entries_); }
+
+  // makes room for n entries in all.
+  void reserve(std::size_t n) {
+    entries_.reserve(n);
+    if (n * 2 > std::size(slots_))
+      rehash(std::bit_ceil(n * 2));
+  }
+
+  void for_each(auto &&f) const {
+    for (auto &&x : entries_)
+      f(x.key_, x.value_);
+  }
+
+  value index(const value &k) const override {
+    if (!is_key(k))
+      return expr_error::invalid_operands;
+    const auto x{find(k)};
+    return x == nullptr ? expr_error::missing_key : *x;
+  }
+
+  value store(const value &k, value x) override {
+    if (!is_key(k))
+      return expr_error::invalid_operands;
+    return operator[](k) = std::move(x);
+  }
+
+  std::ostream &print(std::ostream &os) const override {
+    if (entries_.empty())
+      return os << "[:]";
+    if (printing_)
+      return os << "[...]";
+    printing_ = true;
+    os << '[';
+    for (auto &&x : entries_) {
+      print_element(os << (&x == std::data(entries_) ? "" : ", "), x.key_);
+      print_element(os << ": ", x.value_);
+    }
+    printing_ = false;
+    return os << ']';
+  }
+
+  std::shared_ptr<object> copy(std::shared_ptr<object>,
+                               copier &c) const override {
+    auto &x{c.objects_[this]};
+    if (x != nullptr)
+      return x;
+
+    auto m{std::make_shared<lox_map>()};
+    x = m;
+    m->slots_ = slots_;
+    m->entries_.reserve(std::size(entries_));
+    for (auto &&y : entries_)
+      m->entries_.push_back({y.key_, c(y.value_), y.hash_});
+    return m;
+  }
+
+private:
+  struct entry final {
+    value key_{}, value_{};
+    std::size_t hash_{};
+  };
+
+  static std::size_t hash(const value &k) noexcept {
+    if (!is_number(k))
+      return std::hash<lox_string>{}(std::get<lox_string>(k));
+    // 0 and -0 are the same key.
+    const auto x{std::get<double>(k)};
+    return std::hash<double>{}(x == 0 ? 0 : x);
+  }
+
+  static bool same(const value &x, const value &y) noexcept {
+    if (x.index() != y.index())
+      return false;
+    return is_number(x) ? std::get<double>(x) == std::get<double>(y)
+                        : std::get<lox_string>(x) == std::get<lox_string>(y);
+  }
+
+  // the slot holding k, or the empty slot its probe ends on.
+  std::size_t probe(const value &k, std::size_t h) const noexcept {
+    const auto mask{std::size(slots_) - 1};
+    for (auto i{h & mask};; i = (i + 1) & mask) {
+      const auto s{slots_[i]};
+      if (s == 0)
+        return i;
+      if (const auto &x{entries_[s - 1]}; x.hash_ == h && same(x.key_, k))
+        return i;
+    }
+  }
+
+  void rehash(std::size_t n) {
+    slots_.assign(n, 0);
+    const auto mask{n - 1};
+    for (std::size_t j{}; j < std::size(entries_); ++j) {
+      auto i{entries_[j].hash_ & mask};
+      for (; slots_[i] != 0; i = (i + 1) & mask)
+        ;
+      slots_[i] = j + 1;
+    }
+  }
+
+  std::vector<entry, tracked<entry, subsystem::collections>> entries_{};
+  // one past the index of an entry, or 0 for an empty slot.
+  std::vector<std::uint32_t, tracked<std::uint32_t, subsystem::collections>>
+      slots_{};
+  mutable bool printing_{};
+};
+
+// [x, ...]: a new list of the values of the items, in order.
+struct list_expr final : expr {
+  std::vector<std::unique_ptr<expr>> items_{};
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    auto l{std::make_shared<lox_list>()};
+    l->items_.reserve(std::size(items_));
+    for (auto &&x : items_)
+      l->items_.push_back(x->operator()(environ));
+    return l;
+  }
+};
+
+// [k: v, ...], or [:] for none: a new map of the entries, in order. a later
+// entry for a key replaces an earlier one.
+struct map_expr final : expr {
+  std::vector<std::pair<std::unique_ptr<expr>, std::unique_ptr<expr>>>
+      entries_{};
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    auto m{std::make_shared<lox_map>()};
+    for (auto &&[k, v] : entries_) {
+      const auto key{k->operator()(environ)};
+      if (!lox_map::is_key(key))
+        return expr_error::invalid_operands;
+      (*m)[key] = v->operator()(environ);
+    }
+    return m;
+  }
+};
+
+// len(x) is the number of elements of a list, array or map, or of
+// characters in a string.
+struct length final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (is_string(args[0]))
+      return static_cast<double>(std::size(std::get<lox_string>(args[0])));
+    if (const auto l{to_object<lox_list>(args[0])})
+      return static_cast<double>(std::size(l->items_));
+    if (const auto m{to_object<lox_map>(args[0])})
+      return static_cast<double>(m->size());
+    if (const auto a{to_array(args[0])})
+      return static_cast<double>(std::size(a->data_));
+    return expr_error::invalid_operands;
+  }
+};
+
+// get(c, k) is c[k].
+struct get_item final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (!is_object(args[0]))
+      return expr_error::invalid_operands;
+    return std::get<std::shared_ptr<object>>(args[0])->index(args[1]);
+  }
+};
+
+// set(c, k, x) stores x in c at k and returns it.
+struct set_item final : function {
+  std::size_t arity() const noexcept override { return 3; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (!is_object(args[0]))
+      return expr_error::invalid_operands;
+    return std::get<std::shared_ptr<object>>(args[0])->store(
+        args[1], std::move(args[2]));
+  }
+};
+
+// push(l, x) appends x to l and returns the new length.
+struct list_push final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto l{to_object<lox_list>(args[0])};
+    if (l == nullptr)
+      return expr_error::invalid_operands;
+    l->items_.push_back(std::move(args[1]));
+    return static_cast<double>(std::size(l->items_));
+  }
+};
+
+// pop(l) removes the last element of l and returns it.
+struct list_pop final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto l{to_object<lox_list>(args[0])};
+    if (l == nullptr)
+      return expr_error::invalid_operands;
+    if (l->items_.empty())
+      return expr_error::out_of_range;
+    auto x{std::move(l->items_.back())};
+    l->items_.pop_back();
+    return x;
+  }
+};
+
+// keys(m) and values(m) are new lists of the keys or values of m, in the
+// order of its entries.
+template <bool keys> struct map_items final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto m{to_object<lox_map>(args[0])};
+    if (m == nullptr)
+      return expr_error::invalid_operands;
+
+    auto l{std::make_shared<lox_list>()};
+    l->items_.reserve(m->size());
+    m->for_each([&](const value &k, const value &v) {
+      l->items_.push_back(keys ? k : v);
+    });
+    return l;
+  }
+};
+
+using map_keys = map_items<true>;
+using map_values = map_items<false>;
+
+// has(m, k) is whether m has the key k.
+struct map_has final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto m{to_object<lox_map>(args[0])};
+    if (m == nullptr || !lox_map::is_key(args[1]))
+      return expr_error::invalid_operands;
+    return m->find(args[1]) != nullptr;
+  }
+};
+
+// remove(m, k) erases the key k from m, and is whether it was there.
+struct map_remove final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto m{to_object<lox_map>(args[0])};
+    if (m == nullptr || !lox_map::is_key(args[1]))
+      return expr_error::invalid_operands;
+    return m->erase(args[1]);
+  }
+};
\ No newline at end of file
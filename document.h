@@ -0,0 +1,165 @@
+#pragma once
+
+#include "lexer.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// a source file kept parsed as it is edited, for editors and language
+// servers. the file is split into units, one per top-level declaration, and
+// an edit only relexes and reparses the units it touches, keeping the
+// others' tokens and trees. a unit that fails to parse keeps its
+// diagnostics and has no tree, and the rest of the file is unaffected.
+class document final {
+public:
+  struct unit final {
+    // where the unit starts, and the line it starts on. the first unit
+    // starts at 0 and each other one at its first token; a unit runs to the
+    // next one, or to the end of the file.
+    std::size_t begin_{};
+    int line_{};
+    // offsets and lines are relative to begin_ and line_.
+    token_list tokens_{};
+    // null if the declaration has errors.
+    std::unique_ptr<stmt> stmt_{};
+    std::string diagnostics_{};
+    // whether parsing it looked at the next unit's first token, as an if
+    // does to see if an else follows.
+    bool peeked_{};
+  };
+
+  explicit document(std::string text) : text_{std::move(text)} {
+    reparse(0, 0);
+  }
+
+  // replaces count characters at offset with text.
+  void edit(std::size_t offset, std::size_t count, std::string_view text) {
+    offset = std::min(offset, std::size(text_));
+    count = std::min(count, std::size(text_) - offset);
+
+    const auto lines{
+        static_cast<int>(std::count(std::begin(text), std::end(text), '\n') -
+                         std::count(std::begin(text_) + offset,
+                                    std::begin(text_) + offset + count, '\n'))};
+    const auto first{unit_at(offset)},
+        last{std::min(unit_at(offset + count) + 1, std::size(units_))};
+    text_.replace(offset, count, text);
+
+    for (auto i{last}; i < std::size(units_); ++i) {
+      units_[i].begin_ += std::size(text) - count;
+      units_[i].line_ += lines;
+    }
+    reparse(first, last);
+  }
+
+  const std::string &text() const noexcept { return text_; }
+
+  const std::vector<unit> &units() const noexcept { return units_; }
+
+  // how many units the last edit relexed and reparsed.
+  std::size_t reparsed() const noexcept { return reparsed_; }
+
+private:
+  // the unit holding the character at offset, or the last one.
+  std::size_t unit_at(std::size_t offset) const noexcept {
+    const auto i{std::ranges::upper_bound(units_, offset, {}, &unit::begin_)};
+    return i == std::begin(units_) ? 0 : i - std::begin(units_) - 1;
+  }
+
+  // whether unit i ends in the middle of a token, which whatever follows it
+  // could then extend.
+  bool open(std::size_t i) const noexcept {
+    const auto &u{units_[i]};
+    if (u.tokens_.empty())
+      return true;
+    const auto &x{u.tokens_.back()};
+    return u.begin_ + x.offset_ + x.size_ ==
+           (i + 1 < std::size(units_) ? units_[i + 1].begin_
+                                      : std::size(text_));
+  }
+
+  // relexes and reparses the text of units [first, last), whose ends have
+  // been moved by an edit between them. the range grows until lexing and
+  // parsing it alone gives what lexing and parsing the whole file would.
+  void reparse(std::size_t first, std::size_t last) {
+    // the unit before has to be redone too if the first token may change and
+    // it looked at that token, or if its last token could run on into the
+    // change. in that case, if it has only the one token, so may the unit
+    // before it.
+    for (auto changed{true};
+         changed && first > 0 && (open(first - 1) || units_[first - 1].peeked_);
+         --first)
+      changed = open(first - 1) && std::size(units_[first - 1].tokens_) == 1;
+
+    for (;;) {
+      const auto begin{first < std::size(units_) ? units_[first].begin_ : 0};
+      const auto end{last < std::size(units_) ? units_[last].begin_
+                                              : std::size(text_)};
+      auto parsed{parse(begin, end, last == std::size(units_))};
+      if (!parsed.empty() || last == std::size(units_)) {
+        const auto line{first < std::size(units_) ? units_[first].line_ : 0};
+        for (auto &&x : parsed) {
+          x.begin_ += begin;
+          x.line_ += line;
+        }
+
+        reparsed_ = std::size(parsed);
+        units_.erase(std::begin(units_) + first, std::begin(units_) + last);
+        units_.insert(std::begin(units_) + first,
+                      std::make_move_iterator(std::begin(parsed)),
+                      std::make_move_iterator(std::end(parsed)));
+        return;
+      }
+      // doubling what is reparsed keeps an unclosed block or string, which
+      // runs on to the end of the file, linear in the size of the file.
+      last = std::min(std::size(units_), last + std::max<std::size_t>(
+                                                    1, last - first));
+    }
+  }
+
+  // lexes and parses [begin, end) into units relative to begin. none come
+  // back unless the end is final or the text cannot run on past it.
+  std::vector<unit> parse(std::size_t begin, std::size_t end, bool final) {
+    std::ostringstream diag{};
+    parser p{lexer{text_.substr(begin, end - begin)}.scan(), diag};
+    const auto &tokens{p.tokens_};
+    const auto eof{std::size(tokens) - 1};
+    if (!final &&
+        (eof == 0 || tokens[eof - 1].offset_ + tokens[eof - 1].size_ ==
+                         end - begin))
+      return {};
+
+    std::vector<unit> units{};
+    for (token_list::size_type i{}; i < eof; i = p.current_) {
+      auto s{p.declaration_at(i)};
+      if (!final && p.seen_ >= eof)
+        return {};
+
+      // the first unit also takes whatever comes before its first token.
+      const auto offset{i == 0 ? 0 : tokens[i].offset_};
+      const auto line{i == 0 ? 0 : tokens[i].line_};
+      auto &u{units.emplace_back(offset, line)};
+      u.tokens_.reserve(p.current_ - i);
+      for (auto j{i}; j < p.current_; ++j)
+        u.tokens_.emplace_back(tokens[j].type_, tokens[j].lexeme_,
+                               tokens[j].line_ - line,
+                               tokens[j].offset_ - offset, tokens[j].size_);
+      if (!p.error_)
+        u.stmt_ = std::move(s);
+      u.peeked_ = p.seen_ >= p.current_;
+      u.diagnostics_ = std::move(diag).str();
+      diag.str({});
+    }
+    return units;
+  }
+
+  std::string text_{};
+  std::vector<unit> units_{};
+  std::size_t reparsed_{};
+};
\ No newline at end of file
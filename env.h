@@ -1,22 +1,110 @@
 #pragma once
 
+#include "mem.h"
+#include "symbol.h"
+
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 
-enum struct expr_error { invalid_operands, undefined_identifier };
+enum struct expr_error {
+  invalid_operands,
+  undefined_identifier,
+  not_callable,
+  arity_mismatch,
+  io_error,
+  stack_overflow,
+  out_of_memory,
+  out_of_range,
+  missing_key,
+  out_of_fuel,
+  time_limit,
+  interrupted,
+  syntax_error
+};
+
+struct copier;
+struct object;
+
+// lox string values, charged to subsystem::strings.
+using lox_string = std::basic_string<char, std::char_traits<char>,
+                                     tracked<char, subsystem::strings>>;
+
+template <> struct std::hash<lox_string> {
+  std::size_t operator()(const lox_string &s) const noexcept {
+    return std::hash<std::string_view>{}(s);
+  }
+};
+
+using value = std::variant<double, lox_string, bool, expr_error,
+                           std::shared_ptr<object>>;
+
+// heap-allocated runtime values: functions, tasks, channels, collections.
+struct object {
+  virtual ~object() = default;
+  virtual std::ostream &print(std::ostream &os) const { return os << "<obj>"; }
+  // o[k] and o[k] = x. objects that hold no elements can't be indexed.
+  virtual value index(const value &) const {
+    return expr_error::invalid_operands;
+  }
+  virtual value store(const value &, value) {
+    return expr_error::invalid_operands;
+  }
+  // objects are shared between tasks unless they say otherwise.
+  virtual std::shared_ptr<object> copy(std::shared_ptr<object> self,
+                                       copier &) const {
+    return self;
+  }
+};
 
 struct env final {
-  std::unordered_map<std::string,
-                     std::variant<double, std::string, bool, expr_error>>
-      symbols_{};
+  symbol_table<value> symbols_{};
   std::shared_ptr<env> prev_{};
 
   env(std::shared_ptr<env> prev) : prev_{prev} {}
   env() = default;
 };
 
+// a scope, charged to subsystem::envs along with its symbols.
+std::shared_ptr<env> make_env(std::shared_ptr<env> prev = nullptr) {
+  return std::allocate_shared<env>(tracked<env, subsystem::envs>{},
+                                   std::move(prev));
+}
+
 // std::vector<std::unordered_map<
 //     std::string, std::variant<double, std::string, bool, expr_error>>>
-//     env(1);
\ No newline at end of file
+//     env(1);
+
+// deep copies values handed from one task to another, so that no two threads
+// ever share an env. each env in the source graph is copied exactly once.
+struct copier final {
+  std::unordered_map<const env *, std::shared_ptr<env>> envs_{};
+  // copies of mutable objects, so that they stay shared within the copy.
+  std::unordered_map<const object *, std::shared_ptr<object>> objects_{};
+
+  value operator()(const value &v) {
+    if (!std::holds_alternative<std::shared_ptr<object>>(v))
+      return v;
+    const auto &x{std::get<std::shared_ptr<object>>(v)};
+    return x->copy(x, *this);
+  }
+
+  std::shared_ptr<env> operator()(const std::shared_ptr<env> &e) {
+    if (e == nullptr)
+      return nullptr;
+    if (envs_.contains(e.get()))
+      return envs_[e.get()];
+
+    auto copy{envs_[e.get()] = make_env()};
+    copy->prev_ = operator()(e->prev_);
+    e->symbols_.for_each([&](const symbol *k, const value &v) {
+      copy->symbols_[k] = operator()(v);
+    });
+    return copy;
+  }
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "env.h"
+#include "function.h"
 #include "token.h"
 #include <memory>
 #include <ranges>
@@ -15,13 +16,28 @@ constexpr bool is_number(auto &&x) noexcept {
 }
 
 constexpr bool is_string(auto &&x) noexcept {
-  return std::holds_alternative<std::string>(x);
+  return std::holds_alternative<lox_string>(x);
 }
 
 constexpr bool is_error(auto &&x) noexcept {
   return std::holds_alternative<expr_error>(x);
 }
 
+constexpr bool is_object(auto &&x) noexcept {
+  return std::holds_alternative<std::shared_ptr<object>>(x);
+}
+
+// the T held by x, or null if x holds something else.
+template <typename T> std::shared_ptr<T> to_object(const value &x) {
+  return is_object(x) ? std::dynamic_pointer_cast<T>(
+                            std::get<std::shared_ptr<object>>(x))
+                      : nullptr;
+}
+
+std::shared_ptr<function> to_function(const value &x) {
+  return to_object<function>(x);
+}
+
 std::ostream &operator<<(std::ostream &os, const expr_error &e) {
   switch (e) {
     using enum expr_error;
@@ -29,22 +45,44 @@ std::ostream &operator<<(std::ostream &os, const expr_error &e) {
     return os << "invalid operands";
   case undefined_identifier:
     return os << "undefined identifier";
+  case not_callable:
+    return os << "not callable";
+  case arity_mismatch:
+    return os << "wrong number of arguments";
+  case io_error:
+    return os << "i/o error";
+  case stack_overflow:
+    return os << "stack overflow";
+  case out_of_memory:
+    return os << "heap limit exceeded";
+  case out_of_range:
+    return os << "index out of range";
+  case missing_key:
+    return os << "no such key";
+  case out_of_fuel:
+    return os << "out of fuel";
+  case time_limit:
+    return os << "time limit exceeded";
+  case interrupted:
+    return os << "interrupted";
+  case syntax_error:
+    return os << "syntax error";
   }
 }
 
-bool to_bool(const std::variant<double, std::string, bool, expr_error> &value) {
+bool to_bool(const value &value) {
   return is_error(value) || is_bool(value) && !std::get<bool>(value) ? false
                                                                      : true;
 }
 
-bool to_bool(std::variant<double, std::string, bool, expr_error> &&value) {
+bool to_bool(value &&value) {
   return is_error(value) || is_bool(value) && !std::get<bool>(value) ? false
                                                                      : true;
 }
 
-struct expr {
-  virtual std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept {
+struct expr : tracked_new<subsystem::ast> {
+  virtual ~expr() = default;
+  virtual value operator()(std::shared_ptr<env> environ) const noexcept {
     return {};
   }
   virtual constexpr bool lvalue() const noexcept { return false; }
@@ -53,96 +91,91 @@ struct expr {
 
 struct assign_expr final : expr {
   token identifier_{};
+  const symbol *symbol_{};
   std::unique_ptr<expr> rhs_{};
 
   assign_expr(token identifier, std::unique_ptr<expr> rhs)
-      : identifier_{identifier}, rhs_{std::move(rhs)} {}
-
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
-    for (auto e{environ}; e != nullptr; e = e->prev_)
-      if (e->symbols_.contains(identifier_.lexeme_))
-        return e->symbols_[identifier_.lexeme_] = rhs_->operator()(environ);
+      : identifier_{identifier}, symbol_{symbol::intern(identifier.lexeme_)},
+        rhs_{std::move(rhs)} {}
 
-    std::cout << "undefined identifier " << identifier_.lexeme_ << std::endl;
-    return expr_error::undefined_identifier;
-  }
+  // defined after out__, which an undefined identifier is reported to.
+  value operator()(std::shared_ptr<env> environ) const noexcept override;
 };
 
 struct binary_expr final : expr {
   const token op_{};
-  const std::unique_ptr<expr> lhs_{}, rhs_{};
+  std::unique_ptr<expr> lhs_{}, rhs_{};
 
   binary_expr(token op, std::unique_ptr<expr> lhs, std::unique_ptr<expr> rhs)
       : op_{op}, lhs_{std::move(lhs)}, rhs_{std::move(rhs)} {}
 
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
     const auto x{lhs_->operator()(environ)}, y{rhs_->operator()(environ)};
     switch (op_.type_) {
       using enum token_type;
     default:
       return {};
     case plus__:
-      if (!std::is_same_v<decltype(x), decltype(y)> || is_bool(x))
+      if (x.index() != y.index() || is_error(x) || is_object(x) ||
+          is_bool(x))
         return expr_error::invalid_operands;
       if (is_number(x))
         return std::get<double>(x) + std::get<double>(y);
       else if (is_string(x))
-        return std::get<std::string>(x) + std::get<std::string>(y);
+        return std::get<lox_string>(x) + std::get<lox_string>(y);
     case minus__:
       if (is_number(x) && is_number(y))
         return std::get<double>(x) - std::get<double>(y);
       return expr_error::invalid_operands;
     case star__:
       if (is_number(x) && is_number(y))
-        return std::get<double>(x) - std::get<double>(y);
+        return std::get<double>(x) * std::get<double>(y);
       return expr_error::invalid_operands;
     case slash__:
       if (is_number(x) && is_number(y))
-        return std::get<double>(x) - std::get<double>(y);
+        return std::get<double>(x) / std::get<double>(y);
       return expr_error::invalid_operands;
     case equalequal__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) == std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) == std::get<std::string>(y)
+                 ? std::get<lox_string>(x) == std::get<lox_string>(y)
                  : std::get<bool>(x) == std::get<bool>(y);
     case bangequal__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) != std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) != std::get<std::string>(y)
+                 ? std::get<lox_string>(x) != std::get<lox_string>(y)
                  : std::get<bool>(x) != std::get<bool>(y);
     case greater__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) > std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) > std::get<std::string>(y)
+                 ? std::get<lox_string>(x) > std::get<lox_string>(y)
                  : std::get<bool>(x) > std::get<bool>(y);
     case greaterequal__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) >= std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) >= std::get<std::string>(y)
+                 ? std::get<lox_string>(x) >= std::get<lox_string>(y)
                  : std::get<bool>(x) >= std::get<bool>(y);
     case less__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) < std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) < std::get<std::string>(y)
+                 ? std::get<lox_string>(x) < std::get<lox_string>(y)
                  : std::get<bool>(x) < std::get<bool>(y);
     case lessequal__:
-      if (!std::is_same_v<decltype(x), decltype(y)>)
+      if (x.index() != y.index() || is_error(x) || is_object(x))
         return expr_error::invalid_operands;
       return is_number(x) ? std::get<double>(x) <= std::get<double>(y)
              : is_string(y)
-                 ? std::get<std::string>(x) <= std::get<std::string>(y)
+                 ? std::get<lox_string>(x) <= std::get<lox_string>(y)
                  : std::get<bool>(x) <= std::get<bool>(y);
     case comma__:
       return y;
@@ -155,33 +188,95 @@ struct call_expr final : expr {
   std::vector<std::unique_ptr<expr>> args_{};
 
   call_expr(std::unique_ptr<expr> callee) : callee_{std::move(callee)} {}
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    auto [f, args]{bind(environ)};
+    return f == nullptr ? expr_error::not_callable : f->call(std::move(args));
+  }
+
+  // evaluates the callee and the arguments without making the call. f is
+  // null if the callee is not callable.
+  std::pair<std::shared_ptr<function>, std::vector<value>>
+  bind(std::shared_ptr<env> environ) const noexcept {
+    const auto f{to_function(callee_->operator()(environ))};
+
+    if (f == nullptr)
+      return {};
+
+    std::vector<value> args{};
+    args.reserve(std::size(args_));
+    for (auto &&x : args_)
+      args.push_back(x->operator()(environ));
+
+    return {f, std::move(args)};
+  }
 };
 
 struct grouping_expr final : expr {
-  const std::unique_ptr<expr> body_{};
+  std::unique_ptr<expr> body_{};
 
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
     return body_->operator()(environ);
   }
 };
 
+// o[k]: an element of a list or array, or the value of a key in a map.
+struct index_expr final : expr {
+  std::unique_ptr<expr> object_{}, key_{};
+
+  index_expr(std::unique_ptr<expr> object, std::unique_ptr<expr> key)
+      : object_{std::move(object)}, key_{std::move(key)} {}
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    const auto o{object_->operator()(environ)};
+    const auto k{key_->operator()(environ)};
+    if (!is_object(o))
+      return expr_error::invalid_operands;
+    return std::get<std::shared_ptr<object>>(o)->index(k);
+  }
+};
+
+// o[k] = x. evaluates o, then k, then x, and returns x.
+struct index_assign_expr final : expr {
+  std::unique_ptr<expr> object_{}, key_{}, rhs_{};
+
+  index_assign_expr(std::unique_ptr<expr> object, std::unique_ptr<expr> key,
+                    std::unique_ptr<expr> rhs)
+      : object_{std::move(object)}, key_{std::move(key)},
+        rhs_{std::move(rhs)} {}
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    const auto o{object_->operator()(environ)};
+    const auto k{key_->operator()(environ)};
+    auto x{rhs_->operator()(environ)};
+    if (!is_object(o))
+      return expr_error::invalid_operands;
+    return std::get<std::shared_ptr<object>>(o)->store(k, std::move(x));
+  }
+};
+
 struct literal_expr final : expr {
   const token literal_{};
+  // parsed once here rather than on every evaluation.
+  const value value_{};
+
+  literal_expr(token literal) : literal_{literal}, value_{parse(literal)} {}
+  literal_expr(token_type type) : literal_expr{token{.type_ = type}} {}
 
-  literal_expr(token literal) : literal_{literal} {}
-  literal_expr(token_type type) : literal_{.type_ = type} {}
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    return value_;
+  }
 
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
-    switch (literal_.type_) {
+private:
+  static value parse(const token &literal) {
+    switch (literal.type_) {
       using enum token_type;
     default:
       return {};
     case number__:
-      return std::stod(literal_.lexeme_);
+      return std::stod(literal.lexeme_);
     case string__:
-      return literal_.lexeme_;
+      return lox_string{literal.lexeme_};
     case true__:
       return true;
     case false__:
@@ -192,13 +287,12 @@ struct literal_expr final : expr {
 
 struct unary_expr final : expr {
   const token op_{};
-  const std::unique_ptr<expr> rhs_{};
+  std::unique_ptr<expr> rhs_{};
 
   unary_expr(token op, std::unique_ptr<expr> rhs)
       : op_{op}, rhs_{std::move(rhs)} {}
 
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
     switch (const auto value{rhs_->operator()(environ)}; op_.type_) {
       using enum token_type;
     default:
@@ -219,14 +313,15 @@ struct unary_expr final : expr {
 
 struct var_expr final : expr {
   token identifier_{};
+  const symbol *symbol_{};
 
-  var_expr(token identifier) : identifier_{identifier} {}
+  var_expr(token identifier)
+      : identifier_{identifier}, symbol_{symbol::intern(identifier.lexeme_)} {}
 
-  std::variant<double, std::string, bool, expr_error>
-  operator()(std::shared_ptr<env> environ) const noexcept override {
-    for (auto e{environ}; e != nullptr; e = e->prev_)
-      if (e->symbols_.contains(identifier_.lexeme_))
-        return e->symbols_[identifier_.lexeme_];
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    for (auto e{environ.get()}; e != nullptr; e = e->prev_.get())
+      if (const auto x{e->symbols_.find(symbol_)})
+        return *x;
     return expr_error::undefined_identifier;
   }
 
@@ -1,18 +1,119 @@
 #pragma once
 
+#include "budget.h"
+#include "env.h"
+
+#include <algorithm>
 #include <chrono>
+#include <limits>
+#include <optional>
+#include <pthread.h>
 #include <variant>
 #include <vector>
 
-struct void_t final {};
+constexpr auto variadic__{std::numeric_limits<std::size_t>::max()};
+
+// set when the running program must stop, e.g. on stack overflow. nothing
+// executes while it is engaged; whoever started the program reports and
+// clears it.
+thread_local std::optional<expr_error> error__{};
+
+expr_error fail(expr_error e) noexcept { return *(error__ = e); }
+
+// whether the running program must stop, either on an error or because the
+// heap grew past --max-heap.
+bool halted() noexcept {
+  if (!error__.has_value() && memory::exhausted())
+    error__ = expr_error::out_of_memory;
+  return error__.has_value();
+}
+
+// spends a unit of fuel for a loop iteration or call. returns whether the
+// program must stop, having failed it if its budget ran out.
+bool tick() noexcept {
+  if (ticks__ != 0) {
+    --ticks__;
+    return false;
+  }
+
+  if (budget__ == nullptr) {
+    ticks__ = budget::grant__;
+    return false;
+  }
+
+  const auto x{budget__->take()};
+  if (const auto e{std::get_if<expr_error>(&x)}) {
+    fail(*e);
+    return true;
+  }
+  ticks__ = std::get<std::uint64_t>(x) - 1;
+  return false;
+}
+
+// whether a native waiting on other tasks must give up, having failed the
+// program if its run was interrupted or ran out of time. fuel is not spent
+// while waiting.
+bool stopped() noexcept {
+  if (halted())
+    return true;
+  if (budget__ == nullptr)
+    return false;
+  if (const auto e{budget__->stop()}) {
+    fail(*e);
+    return true;
+  }
+  return false;
+}
+
+// deepest lox call nesting allowed. set with --max-depth.
+//
+// only tail calls run in place: every other call still nests on the native
+// stack, taking one to two kilobytes of it per lox frame depending on the
+// build and on how deep the call sits in its function's statements. the
+// default is what a plain 8 MiB thread stack holds in an unoptimized build
+// with room to spare.
+std::size_t max_depth__{2000};
+
+// whether the native stack is too close to its end for another call. calls
+// that don't fit the stack fail cleanly however high max_depth__ is set, so
+// a larger --max-depth only helps on a larger stack (ulimit -s).
+bool stack_exhausted() noexcept {
+  thread_local const char *const limit{[] {
+    pthread_attr_t attr{};
+    void *first{};
+    std::size_t size{};
+    pthread_getattr_np(pthread_self(), &attr);
+    pthread_attr_getstack(&attr, &first, &size);
+    pthread_attr_destroy(&attr);
+    return static_cast<const char *>(first) +
+           std::min<std::size_t>(size / 4, 1 << 18);
+  }()};
+
+  const char here{};
+  return &here < limit;
+}
 
-struct function {
-  std::vector<std::variant<double, std::string, bool>> args_{};
-  std::variant<double, std::string, bool, void_t> operator()() const noexcept {}
+struct function : object {
+  virtual std::size_t arity() const noexcept { return 0; }
+  virtual value operator()(std::vector<value>) const noexcept {
+    return {};
+  }
+
+  value call(std::vector<value> args) const noexcept {
+    if (tick() || halted())
+      return *error__;
+    if (arity() != variadic__ && arity() != std::size(args))
+      return expr_error::arity_mismatch;
+    return operator()(std::move(args));
+  }
+
+  std::ostream &print(std::ostream &os) const override {
+    return os << "<native fn>";
+  }
 };
 
 struct clock final : function {
-  std::variant<double, std::string, bool, void_t> operator()() const noexcept {
+  value operator()(std::vector<value>) const noexcept override {
     return static_cast<double>(
                std::chrono::time_point_cast<std::chrono::milliseconds>(
                    std::chrono::high_resolution_clock::now())
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "loop.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// how many nodes the expression a function returns may have for calls to it
+// to be inlined, or zero to inline none. set with --inline=n.
+std::size_t inline_budget__{16};
+
+// the arguments of the inlined calls being evaluated on this thread, and
+// where those of the innermost one start.
+thread_local std::vector<value> inline_args__{};
+thread_local std::size_t inline_base__{};
+
+// a parameter of an inlined function, read from its call's arguments.
+struct arg_expr final : expr {
+  std::size_t index_{};
+
+  arg_expr(std::size_t index) : index_{index} {}
+
+  value operator()(std::shared_ptr<env>) const noexcept override {
+    return inline_args__[inline_base__ + index_];
+  }
+};
+
+// a call to a function whose body is a single return, replaced by a copy of
+// the returned expression with the parameters renamed to the arguments. the
+// copy runs only while the callee is still the function it was copied
+// from: once the name means anything else the site deoptimizes for good and
+// makes the call it replaced.
+//
+// returned, the copy still ends in a tail call if it is a call itself, and
+// so does the call it replaced once deoptimized.
+struct inline_expr final : tail_expr {
+  std::unique_ptr<call_expr> call_{};
+  const fun_stmt *decl_{};
+  std::unique_ptr<expr> body_{};
+
+  inline_expr(std::unique_ptr<call_expr> call, const fun_stmt *decl,
+              std::unique_ptr<expr> body)
+      : call_{std::move(call)}, decl_{decl}, body_{std::move(body)},
+        tail_{dynamic_cast<const call_expr *>(body_.get())} {}
+
+  value operator()(std::shared_ptr<env> environ) const noexcept override {
+    value result{};
+    if (inlined(environ, [&](std::shared_ptr<env> closure) {
+          result = body_->operator()(std::move(closure));
+        }))
+      return halted() ? *error__ : result;
+    return call_->operator()(environ);
+  }
+
+  std::pair<std::shared_ptr<function>, std::vector<value>>
+  bind(std::shared_ptr<env> environ, value &result) const noexcept override {
+    std::pair<std::shared_ptr<function>, std::vector<value>> call{};
+    if (inlined(environ, [&](std::shared_ptr<env> closure) {
+          if (tail_ == nullptr)
+            result = body_->operator()(std::move(closure));
+          else if ((call = tail_->bind(std::move(closure))).first == nullptr)
+            result = expr_error::not_callable;
+        })) {
+      if (halted()) {
+        result = *error__;
+        call = {};
+      }
+      return call;
+    }
+
+    if ((call = call_->bind(environ)).first == nullptr)
+      result = expr_error::not_callable;
+    return call;
+  }
+
+private:
+  // runs body on the callee's closure with the copy's arguments in place,
+  // unless the program halts first. false if the site has deoptimized
+  // instead.
+  template <typename F>
+  bool inlined(std::shared_ptr<env> environ, F &&body) const noexcept {
+    if (deoptimized_.load(std::memory_order_relaxed))
+      return false;
+
+    const auto f{to_object<lox_function>(call_->callee_->operator()(environ))};
+    if (f == nullptr || f->decl_ != decl_) {
+      deoptimized_.store(true, std::memory_order_relaxed);
+      return false;
+    }
+
+    const auto base{std::size(inline_args__)};
+    for (auto &&x : call_->args_)
+      inline_args__.push_back(x->operator()(environ));
+    // still a call, as far as fuel goes.
+    if (!tick() && !halted()) {
+      // free names resolve in the closure, as they would in the call.
+      const auto outer{std::exchange(inline_base__, base)};
+      body(f->closure_);
+      inline_base__ = outer;
+    }
+    inline_args__.resize(base);
+    return true;
+  }
+
+  const call_expr *tail_{};
+  mutable std::atomic<bool> deoptimized_{};
+};
+
+// replaces calls to small functions declared once at the top level with
+// copies of what they return. a function qualifies if its body is a single
+// return of an expression of at most inline_budget__ nodes that neither
+// assigns a parameter nor calls the function itself. copies are made from
+// the bodies as declared, so calls inside a copy stay calls. bodies left
+// for later by --lazy-parse and memoized functions are left alone.
+//
+// runs after the loop optimizer, which does not know inlined calls.
+class inliner final {
+public:
+  void operator()(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    if (inline_budget__ == 0)
+      return;
+
+    std::unordered_set<std::string> declared{};
+    for (auto &&x : stmts)
+      if (auto f{dynamic_cast<const fun_stmt *>(x.get())}) {
+        if (!declared.insert(f->name_.lexeme_).second)
+          templates_.erase(f->name_.lexeme_);
+        else if (auto t{make_template(*f)})
+          templates_.emplace(f->name_.lexeme_, std::pair{f, std::move(t)});
+      } else if (auto d{dynamic_cast<const decl_stmt *>(x.get())}) {
+        declared.insert(d->identifier_.lexeme_);
+        templates_.erase(d->identifier_.lexeme_);
+      }
+
+    if (templates_.empty())
+      return;
+    for (auto &&x : stmts)
+      visit(*x);
+  }
+
+private:
+  // the returned expression of f with its parameters renamed, or null if f
+  // does not qualify.
+  std::unique_ptr<expr> make_template(const fun_stmt &f) {
+    if (f.lazy_ != nullptr || f.memo_ != nullptr)
+      return nullptr;
+
+    const auto body{f.body()};
+    if (body == nullptr || std::size(body->stmts_) != 1)
+      return nullptr;
+    const auto ret{dynamic_cast<const return_stmt *>(body->stmts_[0].get())};
+    if (ret == nullptr || ret->value_ == nullptr)
+      return nullptr;
+
+    params_.clear();
+    for (std::size_t i{}; i < std::size(f.params_); ++i)
+      params_[f.params_[i].lexeme_] = i;
+    self_ = f.name_.lexeme_;
+    size_ = 0;
+    return copy(*ret->value_);
+  }
+
+  // copies e, counting its nodes against the budget. null if e is too big
+  // or holds something a copy may not.
+  std::unique_ptr<expr> copy(const expr &e) {
+    if (++size_ > inline_budget__)
+      return nullptr;
+
+    if (auto x{dynamic_cast<const arg_expr *>(&e)})
+      return std::make_unique<arg_expr>(x->index_);
+    if (auto x{dynamic_cast<const assign_expr *>(&e)}) {
+      auto rhs{copy(*x->rhs_)};
+      if (rhs == nullptr || params_.contains(x->identifier_.lexeme_))
+        return nullptr;
+      return std::make_unique<assign_expr>(x->identifier_, std::move(rhs));
+    }
+    if (auto x{dynamic_cast<const binary_expr *>(&e)}) {
+      auto lhs{copy(*x->lhs_)}, rhs{copy(*x->rhs_)};
+      if (lhs == nullptr || rhs == nullptr)
+        return nullptr;
+      return std::make_unique<binary_expr>(x->op_, std::move(lhs),
+                                           std::move(rhs));
+    }
+    if (auto x{dynamic_cast<const call_expr *>(&e)}) {
+      if (auto f{dynamic_cast<const var_expr *>(x->callee_.get())};
+          f != nullptr && f->identifier_.lexeme_ == self_)
+        return nullptr;
+      auto callee{copy(*x->callee_)};
+      if (callee == nullptr)
+        return nullptr;
+      auto c{std::make_unique<call_expr>(std::move(callee))};
+      for (auto &&y : x->args_)
+        if (c->args_.push_back(copy(*y)); c->args_.back() == nullptr)
+          return nullptr;
+      return c;
+    }
+    if (auto x{dynamic_cast<const grouping_expr *>(&e)}) {
+      auto g{std::make_unique<grouping_expr>()};
+      if ((g->body_ = copy(*x->body_)) == nullptr)
+        return nullptr;
+      return g;
+    }
+    if (auto x{dynamic_cast<const index_expr *>(&e)}) {
+      auto object{copy(*x->object_)}, key{copy(*x->key_)};
+      if (object == nullptr || key == nullptr)
+        return nullptr;
+      return std::make_unique<index_expr>(std::move(object), std::move(key));
+    }
+    if (auto x{dynamic_cast<const index_assign_expr *>(&e)}) {
+      auto object{copy(*x->object_)}, key{copy(*x->key_)},
+          rhs{copy(*x->rhs_)};
+      if (object == nullptr || key == nullptr || rhs == nullptr)
+        return nullptr;
+      return std::make_unique<index_assign_expr>(
+          std::move(object), std::move(key), std::move(rhs));
+    }
+    if (auto x{dynamic_cast<const list_expr *>(&e)}) {
+      auto l{std::make_unique<list_expr>()};
+      for (auto &&y : x->items_)
+        if (l->items_.push_back(copy(*y)); l->items_.back() == nullptr)
+          return nullptr;
+      return l;
+    }
+    if (auto x{dynamic_cast<const map_expr *>(&e)}) {
+      auto m{std::make_unique<map_expr>()};
+      for (auto &&[k, v] : x->entries_) {
+        auto key{copy(*k)}, value{copy(*v)};
+        if (key == nullptr || value == nullptr)
+          return nullptr;
+        m->entries_.emplace_back(std::move(key), std::move(value));
+      }
+      return m;
+    }
+    if (auto x{dynamic_cast<const literal_expr *>(&e)})
+      return std::make_unique<literal_expr>(x->literal_);
+    if (auto x{dynamic_cast<const unary_expr *>(&e)}) {
+      auto rhs{copy(*x->rhs_)};
+      if (rhs == nullptr)
+        return nullptr;
+      return std::make_unique<unary_expr>(x->op_, std::move(rhs));
+    }
+    if (auto x{dynamic_cast<const var_expr *>(&e)}) {
+      if (const auto i{params_.find(x->identifier_.lexeme_)};
+          i != std::end(params_))
+        return std::make_unique<arg_expr>(i->second);
+      return std::make_unique<var_expr>(x->identifier_);
+    }
+    return nullptr;
+  }
+
+  void visit(stmt &s) {
+    if (auto x{dynamic_cast<block_stmt *>(&s)})
+      for (auto &&y : x->stmts_)
+        visit(*y);
+    else if (auto x{dynamic_cast<decl_stmt *>(&s)}) {
+      if (x->value_ != nullptr)
+        visit(x->value_);
+    } else if (auto x{dynamic_cast<expr_stmt *>(&s)})
+      visit(x->expr_);
+    else if (auto x{dynamic_cast<fun_stmt *>(&s)}) {
+      if (x->lazy_ == nullptr)
+        visit(*x->body_);
+    } else if (auto x{dynamic_cast<if_stmt *>(&s)}) {
+      visit(x->condition_);
+      visit(*x->if_branch_);
+      if (x->else_branch_ != nullptr)
+        visit(*x->else_branch_);
+    } else if (auto x{dynamic_cast<print_stmt *>(&s)})
+      visit(x->expr_);
+    else if (auto x{dynamic_cast<return_stmt *>(&s)}) {
+      if (x->value_ != nullptr) {
+        visit(x->value_);
+        // an inlined call still ends in a tail call, if any.
+        if (auto i{dynamic_cast<const inline_expr *>(x->value_.get())}) {
+          x->tail_call_ = nullptr;
+          x->tail_expr_ = i;
+        }
+      }
+    } else if (auto x{dynamic_cast<while_stmt *>(&s)}) {
+      for (auto &&[_, e] : x->hoisted_)
+        visit(e);
+      visit(x->condition_);
+      visit(*x->body_);
+    }
+  }
+
+  void visit(std::unique_ptr<expr> &e) {
+    if (auto x{dynamic_cast<assign_expr *>(e.get())})
+      visit(x->rhs_);
+    else if (auto x{dynamic_cast<binary_expr *>(e.get())}) {
+      visit(x->lhs_);
+      visit(x->rhs_);
+    } else if (auto x{dynamic_cast<call_expr *>(e.get())}) {
+      visit(x->callee_);
+      for (auto &&y : x->args_)
+        visit(y);
+      inline_call(e);
+    } else if (auto x{dynamic_cast<grouping_expr *>(e.get())})
+      visit(x->body_);
+    else if (auto x{dynamic_cast<index_expr *>(e.get())}) {
+      visit(x->object_);
+      visit(x->key_);
+    } else if (auto x{dynamic_cast<index_assign_expr *>(e.get())}) {
+      visit(x->object_);
+      visit(x->key_);
+      visit(x->rhs_);
+    } else if (auto x{dynamic_cast<list_expr *>(e.get())}) {
+      for (auto &&y : x->items_)
+        visit(y);
+    } else if (auto x{dynamic_cast<map_expr *>(e.get())}) {
+      for (auto &&[k, v] : x->entries_)
+        visit(k), visit(v);
+    } else if (auto x{dynamic_cast<unary_expr *>(e.get())})
+      visit(x->rhs_);
+  }
+
+  // replaces the call e with a copy of its callee's template, if it calls a
+  // function that qualifies with the right number of arguments.
+  void inline_call(std::unique_ptr<expr> &e) {
+    const auto &c{static_cast<const call_expr &>(*e)};
+    const auto callee{dynamic_cast<const var_expr *>(c.callee_.get())};
+    if (callee == nullptr)
+      return;
+    const auto i{templates_.find(callee->identifier_.lexeme_)};
+    if (i == std::end(templates_) ||
+        std::size(c.args_) != std::size(i->second.first->params_))
+      return;
+
+    // the template holds no parameters, so this copy can't fail.
+    params_.clear();
+    self_.clear();
+    size_ = 0;
+    auto body{copy(*i->second.second)};
+    std::unique_ptr<call_expr> call{static_cast<call_expr *>(e.release())};
+    e = std::make_unique<inline_expr>(std::move(call), i->second.first,
+                                      std::move(body));
+  }
+
+  std::unordered_map<std::string,
+                     std::pair<const fun_stmt *, std::unique_ptr<expr>>>
+      templates_{};
+  // the parameters of the function being copied, and its name.
+  std::unordered_map<std::string, std::size_t> params_{};
+  std::string self_{};
+  std::size_t size_{};
+};
+
+// runs the optimizations over a parsed program.
+void optimize(const std::vector<std::unique_ptr<stmt>> &stmts) {
+  loop_optimizer{}(stmts);
+  inliner{}(stmts);
+}
\ No newline at end of file
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "expr.h"
+
+#include <arpa/inet.h>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <netinet/in.h>
+#include <optional>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// epoll driven loop behind the i/o natives. natives start an operation and
+// return at once; completions are queued and their callbacks run when the
+// loop is drained, after the code that started them has finished.
+class event_loop final {
+public:
+  ~event_loop() {
+    clear();
+    if (epoll_ >= 0)
+      close(epoll_);
+  }
+
+  void post(std::function<void()> f) { ready_.push_back(std::move(f)); }
+
+  void post(std::shared_ptr<function> cb, value x) {
+    post([cb, x{std::move(x)}] { cb->call({x}); });
+  }
+
+  // calls handler whenever fd is ready for events, until it returns true.
+  // fd is then closed. files epoll cannot watch are always ready, so their
+  // handler just runs to completion.
+  void watch(int fd, std::uint32_t events,
+             std::function<bool(std::uint32_t)> handler) {
+    if (epoll_ < 0)
+      epoll_ = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_event e{.events = events, .data = {.fd = fd}};
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &e) < 0) {
+      for (; !handler(events);)
+        ;
+      close(fd);
+      return;
+    }
+
+    handlers_[fd] = std::move(handler);
+  }
+
+  void modify(int fd, std::uint32_t events) {
+    epoll_event e{.events = events, .data = {.fd = fd}};
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &e);
+  }
+
+  // runs until nothing is left to wait for, or the program must stop: a
+  // callback failed it, or its run was interrupted or ran out of time.
+  // epoll is waited on for at most poll__ at a time so the run is checked
+  // while idle. whatever is pending when the program stops is dropped.
+  void run() {
+    for (std::array<epoll_event, 64> events{};;) {
+      for (; !ready_.empty();) {
+        if (halted()) {
+          clear();
+          return;
+        }
+        auto f{std::move(ready_.front())};
+        ready_.pop_front();
+        f();
+      }
+
+      if (handlers_.empty())
+        return;
+      if (stopped()) {
+        clear();
+        return;
+      }
+
+      const auto n{epoll_wait(epoll_, std::data(events), std::size(events),
+                              poll__.count())};
+      for (int i{}; i < n; ++i) {
+        const auto fd{events[i].data.fd};
+        if (handlers_.contains(fd) && handlers_[fd](events[i].events)) {
+          epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+          handlers_.erase(fd);
+          close(fd);
+        }
+      }
+    }
+  }
+
+private:
+  static constexpr std::chrono::milliseconds poll__{10};
+
+  void clear() {
+    for (auto &&[fd, _] : handlers_) {
+      epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+    }
+    handlers_.clear();
+    ready_.clear();
+  }
+
+  int epoll_{-1};
+  std::unordered_map<int, std::function<bool(std::uint32_t)>> handlers_{};
+  std::deque<std::function<void()>> ready_{};
+};
+
+event_loop &io_loop() {
+  thread_local event_loop loop{};
+  return loop;
+}
+
+// reads fd into data until it would block. once eof or an error is hit,
+// returns the data read or the error.
+std::optional<value> drain(int fd, lox_string &data) {
+  for (std::array<char, 65536> buf{};;) {
+    const auto n{::read(fd, std::data(buf), std::size(buf))};
+    if (n > 0) {
+      data.append(std::data(buf), n);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return std::nullopt;
+    return n == 0 ? value{std::move(data)} : expr_error::io_error;
+  }
+}
+
+// writes data from offset on until fd would block. returns true once all of
+// it is written or an error is hit.
+bool fill(int fd, const lox_string &data, std::size_t &offset) {
+  for (; offset < std::size(data);) {
+    const auto n{
+        ::write(fd, std::data(data) + offset, std::size(data) - offset)};
+    if (n > 0) {
+      offset += n;
+      continue;
+    }
+    return n < 0 && (errno == EAGAIN || errno == EINTR) ? false : true;
+  }
+  return true;
+}
+
+// read(path, cb) calls cb with the contents of the file, pipe or socket at
+// path.
+struct read_file final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto cb{to_function(args.back())};
+    if (!is_string(args.front()) || cb == nullptr)
+      return expr_error::invalid_operands;
+
+    const auto fd{open(std::get<lox_string>(args.front()).c_str(),
+                       O_RDONLY | O_NONBLOCK | O_CLOEXEC)};
+    if (fd < 0) {
+      io_loop().post(cb, expr_error::io_error);
+      return true;
+    }
+
+    io_loop().watch(fd, EPOLLIN,
+                    [fd, cb, data{lox_string{}}](std::uint32_t) mutable {
+                      const auto x{drain(fd, data)};
+                      if (x.has_value())
+                        io_loop().post(cb, *x);
+                      return x.has_value();
+                    });
+    return true;
+  }
+};
+
+// write(path, data, cb) replaces the contents at path with data and calls cb
+// with the number of bytes written.
+struct write_file final : function {
+  std::size_t arity() const noexcept override { return 3; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto cb{to_function(args.back())};
+    if (!is_string(args[0]) || !is_string(args[1]) || cb == nullptr)
+      return expr_error::invalid_operands;
+
+    const auto fd{open(std::get<lox_string>(args[0]).c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC,
+                       0644)};
+    if (fd < 0) {
+      io_loop().post(cb, expr_error::io_error);
+      return true;
+    }
+
+    io_loop().watch(fd, EPOLLOUT,
+                    [fd, cb, data{std::get<lox_string>(std::move(args[1]))},
+                     offset{std::size_t{}}](std::uint32_t) mutable {
+                      if (!fill(fd, data, offset))
+                        return false;
+                      io_loop().post(
+                          cb, offset == std::size(data)
+                                  ? value{static_cast<double>(offset)}
+                                  : expr_error::io_error);
+                      return true;
+                    });
+    return true;
+  }
+};
+
+sockaddr_in loopback(double port) {
+  return {.sin_family = AF_INET,
+          .sin_port = htons(static_cast<std::uint16_t>(port)),
+          .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)},
+          .sin_zero = {}};
+}
+
+// dial(port, data, cb) connects to port on the loopback interface, sends
+// data, and calls cb with everything the peer sends back before closing.
+struct dial final : function {
+  std::size_t arity() const noexcept override { return 3; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto cb{to_function(args.back())};
+    if (!is_number(args[0]) || !is_string(args[1]) || cb == nullptr)
+      return expr_error::invalid_operands;
+
+    const auto fd{socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0)};
+    if (fd < 0) {
+      io_loop().post(cb, expr_error::io_error);
+      return true;
+    }
+
+    if (const auto addr{loopback(std::get<double>(args[0]))};
+        connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) <
+            0 &&
+        errno != EINPROGRESS) {
+      close(fd);
+      io_loop().post(cb, expr_error::io_error);
+      return true;
+    }
+
+    io_loop().watch(
+        fd, EPOLLOUT,
+        [fd, cb, data{std::get<lox_string>(std::move(args[1]))},
+         offset{std::size_t{}}, sent{false}](std::uint32_t events) mutable {
+          if (sent) {
+            const auto x{drain(fd, data)};
+            if (x.has_value())
+              io_loop().post(cb, *x);
+            return x.has_value();
+          }
+
+          if (events & (EPOLLERR | EPOLLHUP)) {
+            io_loop().post(cb, expr_error::io_error);
+            return true;
+          }
+          if (!fill(fd, data, offset))
+            return false;
+          if (offset != std::size(data)) {
+            io_loop().post(cb, expr_error::io_error);
+            return true;
+          }
+
+          sent = true;
+          data.clear();
+          shutdown(fd, SHUT_WR);
+          io_loop().modify(fd, EPOLLIN);
+          return false;
+        });
+    return true;
+  }
+};
+
+// serve(port, n, handler) accepts n connections on the loopback interface.
+// each request is read until the peer stops sending, and handler's result
+// is written back if it is a string.
+struct serve final : function {
+  std::size_t arity() const noexcept override { return 3; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto handler{to_function(args.back())};
+    if (!is_number(args[0]) || !is_number(args[1]) || handler == nullptr)
+      return expr_error::invalid_operands;
+
+    const auto fd{socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0)};
+    const auto addr{loopback(std::get<double>(args[0]))};
+    const int on{1};
+    if (fd < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) < 0 ||
+        bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+      if (fd >= 0)
+        close(fd);
+      return expr_error::io_error;
+    }
+
+    io_loop().watch(fd, EPOLLIN,
+                    [fd, handler, n{std::get<double>(args[1])}](
+                        std::uint32_t) mutable {
+                      for (; n > 0; --n) {
+                        const auto conn{accept4(fd, nullptr, nullptr,
+                                                SOCK_NONBLOCK | SOCK_CLOEXEC)};
+                        if (conn < 0)
+                          return false;
+                        respond(conn, handler);
+                      }
+                      return true;
+                    });
+    return true;
+  }
+
+  static void respond(int conn, std::shared_ptr<function> handler) {
+    io_loop().watch(conn, EPOLLIN,
+                    [conn, handler, data{lox_string{}}, offset{std::size_t{}},
+                     replying{false}](std::uint32_t) mutable {
+                      if (replying)
+                        return fill(conn, data, offset);
+
+                      const auto request{drain(conn, data)};
+                      if (!request.has_value())
+                        return false;
+
+                      const auto response{is_string(*request)
+                                              ? handler->call({*request})
+                                              : value{}};
+                      if (!is_string(response))
+                        return true;
+
+                      data = std::get<lox_string>(response);
+                      replying = true;
+                      io_loop().modify(conn, EPOLLOUT);
+                      return false;
+                    });
+  }
+};
\ No newline at end of file
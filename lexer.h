@@ -17,10 +17,11 @@ class lexer final {
 public:
   lexer(std::string source) : source_{source} {}
 
-  std::vector<token> scan() {
+  token_list scan() {
     for (; !is_end(); scan_token())
       ;
 
+    prev_ = next_;
     add_token(token_type::eof__);
 
     return tokens_;
@@ -32,7 +33,12 @@ private:
     switch (const auto c{next()}; c) {
       using enum token_type;
     default:
-      std::isalpha(c) ? identifier() : number_literal();
+      if (std::isalpha(c))
+        identifier();
+      else if (std::isdigit(c))
+        number_literal();
+      else
+        add_token(unknown__);
       break;
     case '(':
       add_token(l_paren__);
@@ -46,6 +52,15 @@ private:
     case '}':
       add_token(r_brace__);
       break;
+    case '[':
+      add_token(l_bracket__);
+      break;
+    case ']':
+      add_token(r_bracket__);
+      break;
+    case ':':
+      add_token(colon__);
+      break;
     case '.':
       add_token(dot__);
       break;
@@ -103,15 +118,19 @@ private:
   }
 
   void string_literal() {
+    // the token is on the line the string starts on.
+    int lines{};
     for (; !is_end() && peek() != '"'; next())
-      ;
+      lines += peek() == '\n';
 
+    const auto last{next_};
     if (is_end())
       // handle error
       ;
 
-    add_token(token_type::string__, prev_ + 1, next_);
     next();
+    add_token(token_type::string__, prev_ + 1, last);
+    line_ += lines;
   }
 
   void number_literal() {
@@ -129,7 +148,8 @@ private:
 
   void add_token(token_type type, std::string::size_type first,
                  std::string::size_type last) {
-    tokens_.emplace_back(type, source_.substr(first, last - first), line_);
+    tokens_.emplace_back(type, source_.substr(first, last - first), line_,
+                         prev_, next_ - prev_);
   }
 
   bool match(char c) noexcept { return c == peek() ? (++next_, true) : false; }
@@ -145,7 +165,7 @@ private:
   bool is_end() const noexcept { return next_ >= std::size(source_); }
 
   const std::string source_{};
-  std::vector<token> tokens_{};
+  token_list tokens_{};
   std::string::size_type prev_{}, next_{};
   int line_{};
 };
\ No newline at end of file
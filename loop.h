@@ -0,0 +1,361 @@
+#pragma once
+
+#include "purity.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_set>
+
+// rewrites loops so each iteration does less: expressions that can't change
+// while a loop runs are evaluated once before it, loops counting towards a
+// bound keep their counter unboxed, and blocks that declare nothing stop
+// opening a scope each time they run.
+//
+// a variable is loop invariant if nothing in the loop assigns or declares
+// it. a loop that calls functions also needs the variable to be local:
+// declared in a block or parameter list of the code around the loop, where
+// no function declared in that code assigns it, since only such functions
+// could reach it.
+class loop_optimizer final {
+public:
+  using names = purity::names;
+
+  void operator()(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    scopes_.assign(1, {});
+    base_ = 1;
+    captured_.clear();
+    opaque_ = false;
+    for (auto &&x : stmts)
+      captured(*x);
+
+    for (auto &&x : stmts)
+      visit(*x);
+  }
+
+  // optimizes the body of a function parsed on its own, after the code
+  // around it was.
+  void operator()(const std::vector<token> &params, stmt &body) {
+    scopes_.clear();
+    base_ = 0;
+    captured_.clear();
+    opaque_ = false;
+    function(params, body);
+  }
+
+private:
+  void visit(stmt &s) {
+    if (auto x{dynamic_cast<block_stmt *>(&s)}) {
+      scopes_.emplace_back();
+      for (auto &&y : x->stmts_)
+        visit(*y);
+      scopes_.pop_back();
+      x->scoped_ = std::ranges::any_of(x->stmts_, [](auto &&y) {
+        return dynamic_cast<const decl_stmt *>(y.get()) != nullptr ||
+               dynamic_cast<const fun_stmt *>(y.get()) != nullptr;
+      });
+    } else if (auto x{dynamic_cast<const decl_stmt *>(&s)})
+      scopes_.back().insert(x->identifier_.lexeme_);
+    else if (auto x{dynamic_cast<fun_stmt *>(&s)}) {
+      scopes_.back().insert(x->name_.lexeme_);
+      // a body left for later is optimized once it is parsed.
+      if (x->lazy_ == nullptr)
+        function(x->params_, *x->body_);
+    } else if (auto x{dynamic_cast<if_stmt *>(&s)}) {
+      visit(*x->if_branch_);
+      if (x->else_branch_ != nullptr)
+        visit(*x->else_branch_);
+    } else if (auto x{dynamic_cast<while_stmt *>(&s)}) {
+      // hoisting comes before the loops inside are optimized, so it never
+      // sees their slots. finding the counter needs the body's scope, which
+      // is only known once the body is visited.
+      hoist(*x);
+      visit(*x->body_);
+      count(*x);
+    }
+  }
+
+  void function(const std::vector<token> &params, stmt &body) {
+    const auto base{std::exchange(base_, std::size(scopes_))};
+    auto outer{std::exchange(captured_, {})};
+    const auto opaque{std::exchange(opaque_, false)};
+    captured(body);
+
+    scopes_.emplace_back();
+    for (auto &&x : params)
+      scopes_.back().insert(x.lexeme_);
+    visit(body);
+    scopes_.pop_back();
+
+    base_ = base;
+    captured_ = std::move(outer);
+    opaque_ = opaque;
+  }
+
+  // whether w can call a function.
+  static bool calls(const while_stmt &w) {
+    return calls(*w.condition_) || calls(*w.body_);
+  }
+
+  // tells whether a variable can't change while w runs.
+  auto invariant(const while_stmt &w) const {
+    names changed{};
+    purity::assigned(*w.condition_, changed);
+    purity::assigned(*w.body_, changed, false);
+    return [this, changed = std::move(changed),
+            calling = calls(w)](const std::string &name) {
+      return name.starts_with('%') ||
+             (!changed.contains(name) && (!calling || local(name)));
+    };
+  }
+
+  void hoist(while_stmt &w) {
+    const auto invariant{this->invariant(w)};
+    hoist(w.condition_, w, invariant);
+    hoist(*w.body_, w, invariant);
+  }
+
+  // keeps the counter of w unboxed, if w counts towards a bound.
+  void count(while_stmt &w) {
+    const auto cond{dynamic_cast<const binary_expr *>(w.condition_.get())};
+    const auto body{dynamic_cast<const block_stmt *>(w.body_.get())};
+    if (cond == nullptr || body == nullptr || body->scoped_ ||
+        body->stmts_.empty())
+      return;
+
+    using enum token_type;
+    const auto i{dynamic_cast<const var_expr *>(cond->lhs_.get())};
+    if (i == nullptr || (cond->op_.type_ != less__ &&
+                         cond->op_.type_ != lessequal__ &&
+                         cond->op_.type_ != greater__ &&
+                         cond->op_.type_ != greaterequal__))
+      return;
+
+    const auto &name{i->identifier_.lexeme_};
+    const auto step{this->step(*body->stmts_.back(), name)};
+    if (!step.has_value())
+      return;
+
+    // the step must be the only thing changing the counter.
+    names others{};
+    purity::assigned(*w.condition_, others);
+    for (std::size_t j{}; j + 1 < std::size(body->stmts_); ++j)
+      purity::assigned(*body->stmts_[j], others, false);
+    if (others.contains(name) || (calls(w) && !local(name)))
+      return;
+
+    const auto bound{cond->rhs_.get()};
+    const auto fixed{
+        dynamic_cast<const literal_expr *>(bound) != nullptr ||
+        (dynamic_cast<const var_expr *>(bound) != nullptr &&
+         invariant(w)(
+             static_cast<const var_expr *>(bound)->identifier_.lexeme_))};
+
+    w.counter_ =
+        counter{symbol::intern(name), cond->op_.type_, bound, fixed, *step};
+  }
+
+  // the constant s steps name by, if s is `name = name + c` or
+  // `name = name - c`.
+  static std::optional<double> step(const stmt &s, const std::string &name) {
+    const auto x{dynamic_cast<const expr_stmt *>(&s)};
+    const auto assign{
+        x == nullptr ? nullptr
+                     : dynamic_cast<const assign_expr *>(x->expr_.get())};
+    if (assign == nullptr || assign->identifier_.lexeme_ != name)
+      return std::nullopt;
+
+    const auto rhs{dynamic_cast<const binary_expr *>(assign->rhs_.get())};
+    if (rhs == nullptr || (rhs->op_.type_ != token_type::plus__ &&
+                               rhs->op_.type_ != token_type::minus__))
+      return std::nullopt;
+
+    const auto lhs{dynamic_cast<const var_expr *>(rhs->lhs_.get())};
+    const auto c{dynamic_cast<const literal_expr *>(rhs->rhs_.get())};
+    if (lhs == nullptr || lhs->identifier_.lexeme_ != name || c == nullptr ||
+        !is_number(c->value_))
+      return std::nullopt;
+
+    const auto d{std::get<double>(c->value_)};
+    return rhs->op_.type_ == token_type::plus__ ? d : -d;
+  }
+
+  // replaces the largest invariant expressions run directly by the loop,
+  // outside any function it declares, with reads of hoisted slots.
+  void hoist(stmt &s, while_stmt &w, const auto &invariant) {
+    if (auto x{dynamic_cast<block_stmt *>(&s)})
+      for (auto &&y : x->stmts_)
+        hoist(*y, w, invariant);
+    else if (auto x{dynamic_cast<decl_stmt *>(&s)}) {
+      if (x->value_ != nullptr)
+        hoist(x->value_, w, invariant);
+    } else if (auto x{dynamic_cast<expr_stmt *>(&s)})
+      hoist(x->expr_, w, invariant);
+    else if (auto x{dynamic_cast<if_stmt *>(&s)}) {
+      hoist(x->condition_, w, invariant);
+      hoist(*x->if_branch_, w, invariant);
+      if (x->else_branch_ != nullptr)
+        hoist(*x->else_branch_, w, invariant);
+    } else if (auto x{dynamic_cast<print_stmt *>(&s)})
+      hoist(x->expr_, w, invariant);
+    else if (auto x{dynamic_cast<return_stmt *>(&s)}) {
+      // calls are never hoisted, so a tail call stays where it is.
+      if (x->value_ != nullptr)
+        hoist(x->value_, w, invariant);
+    } else if (auto x{dynamic_cast<while_stmt *>(&s)}) {
+      hoist(x->condition_, w, invariant);
+      hoist(*x->body_, w, invariant);
+    }
+  }
+
+  void hoist(std::unique_ptr<expr> &e, while_stmt &w, const auto &invariant) {
+    if (worth_hoisting(*e) && invariant_expr(*e, invariant)) {
+      // no identifier the lexer produces can clash with the slot's name.
+      auto name{"%" + std::to_string(next_slot__++)};
+      auto slot{std::make_unique<var_expr>(
+          token{.type_ = token_type::identifier__, .lexeme_ = name})};
+      w.hoisted_.emplace_back(symbol::intern(name),
+                              std::exchange(e, std::move(slot)));
+      return;
+    }
+
+    if (auto x{dynamic_cast<assign_expr *>(e.get())})
+      hoist(x->rhs_, w, invariant);
+    else if (auto x{dynamic_cast<binary_expr *>(e.get())}) {
+      hoist(x->lhs_, w, invariant);
+      hoist(x->rhs_, w, invariant);
+    } else if (auto x{dynamic_cast<call_expr *>(e.get())}) {
+      hoist(x->callee_, w, invariant);
+      for (auto &&y : x->args_)
+        hoist(y, w, invariant);
+    } else if (auto x{dynamic_cast<grouping_expr *>(e.get())})
+      hoist(x->body_, w, invariant);
+    else if (auto x{dynamic_cast<index_expr *>(e.get())}) {
+      hoist(x->object_, w, invariant);
+      hoist(x->key_, w, invariant);
+    } else if (auto x{dynamic_cast<index_assign_expr *>(e.get())}) {
+      hoist(x->object_, w, invariant);
+      hoist(x->key_, w, invariant);
+      hoist(x->rhs_, w, invariant);
+    } else if (auto x{dynamic_cast<list_expr *>(e.get())}) {
+      // the literal itself makes a new list each time, so stays put.
+      for (auto &&y : x->items_)
+        hoist(y, w, invariant);
+    } else if (auto x{dynamic_cast<map_expr *>(e.get())}) {
+      for (auto &&[k, v] : x->entries_)
+        hoist(k, w, invariant), hoist(v, w, invariant);
+    } else if (auto x{dynamic_cast<unary_expr *>(e.get())})
+      hoist(x->rhs_, w, invariant);
+  }
+
+  // a bare variable or literal is as cheap to evaluate as a hoisted slot.
+  static bool worth_hoisting(const expr &e) {
+    if (dynamic_cast<const binary_expr *>(&e))
+      return true;
+    if (auto x{dynamic_cast<const grouping_expr *>(&e)})
+      return worth_hoisting(*x->body_);
+    if (auto x{dynamic_cast<const unary_expr *>(&e)})
+      return dynamic_cast<const literal_expr *>(x->rhs_.get()) == nullptr;
+    return false;
+  }
+
+  static bool invariant_expr(const expr &e, const auto &invariant) {
+    if (auto x{dynamic_cast<const binary_expr *>(&e)})
+      return invariant_expr(*x->lhs_, invariant) &&
+             invariant_expr(*x->rhs_, invariant);
+    if (auto x{dynamic_cast<const grouping_expr *>(&e)})
+      return invariant_expr(*x->body_, invariant);
+    if (dynamic_cast<const literal_expr *>(&e))
+      return true;
+    if (auto x{dynamic_cast<const unary_expr *>(&e)})
+      return invariant_expr(*x->rhs_, invariant);
+    if (auto x{dynamic_cast<const var_expr *>(&e)})
+      return invariant(x->identifier_.lexeme_);
+    return false;
+  }
+
+  // whether name is declared in the code around the loop, out of reach of
+  // functions declared elsewhere and never assigned by one declared here.
+  bool local(const std::string &name) const {
+    for (auto i{std::size(scopes_)}; i-- > 0;)
+      if (scopes_[i].contains(name))
+        return i >= base_ && !opaque_ && !captured_.contains(name);
+    return false;
+  }
+
+  // whether running s or e can call a function.
+  static bool calls(const stmt &s) {
+    if (auto x{dynamic_cast<const block_stmt *>(&s)})
+      return std::ranges::any_of(x->stmts_,
+                                 [](auto &&y) { return calls(*y); });
+    if (auto x{dynamic_cast<const decl_stmt *>(&s)})
+      return x->value_ != nullptr && calls(*x->value_);
+    if (auto x{dynamic_cast<const expr_stmt *>(&s)})
+      return calls(*x->expr_);
+    if (auto x{dynamic_cast<const if_stmt *>(&s)})
+      return calls(*x->condition_) || calls(*x->if_branch_) ||
+             (x->else_branch_ != nullptr && calls(*x->else_branch_));
+    if (auto x{dynamic_cast<const print_stmt *>(&s)})
+      return calls(*x->expr_);
+    if (auto x{dynamic_cast<const return_stmt *>(&s)})
+      return x->value_ != nullptr && calls(*x->value_);
+    if (auto x{dynamic_cast<const while_stmt *>(&s)})
+      return calls(*x->condition_) || calls(*x->body_);
+    return false;
+  }
+
+  static bool calls(const expr &e) {
+    if (dynamic_cast<const call_expr *>(&e))
+      return true;
+    if (auto x{dynamic_cast<const assign_expr *>(&e)})
+      return calls(*x->rhs_);
+    if (auto x{dynamic_cast<const binary_expr *>(&e)})
+      return calls(*x->lhs_) || calls(*x->rhs_);
+    if (auto x{dynamic_cast<const grouping_expr *>(&e)})
+      return calls(*x->body_);
+    if (auto x{dynamic_cast<const index_expr *>(&e)})
+      return calls(*x->object_) || calls(*x->key_);
+    if (auto x{dynamic_cast<const index_assign_expr *>(&e)})
+      return calls(*x->object_) || calls(*x->key_) || calls(*x->rhs_);
+    if (auto x{dynamic_cast<const list_expr *>(&e)})
+      return std::ranges::any_of(x->items_,
+                                 [](auto &&y) { return calls(*y); });
+    if (auto x{dynamic_cast<const map_expr *>(&e)})
+      return std::ranges::any_of(x->entries_, [](auto &&y) {
+        return calls(*y.first) || calls(*y.second);
+      });
+    if (auto x{dynamic_cast<const unary_expr *>(&e)})
+      return calls(*x->rhs_);
+    return false;
+  }
+
+  // adds the names assigned by functions declared anywhere in s to
+  // captured_, or sets opaque_ if one has a body left for later.
+  void captured(const stmt &s) {
+    if (auto x{dynamic_cast<const block_stmt *>(&s)})
+      for (auto &&y : x->stmts_)
+        captured(*y);
+    else if (auto x{dynamic_cast<const fun_stmt *>(&s)}) {
+      if (x->lazy_ != nullptr)
+        opaque_ = true;
+      else
+        purity::assigned(*x->body_, captured_, false);
+    } else if (auto x{dynamic_cast<const if_stmt *>(&s)}) {
+      captured(*x->if_branch_);
+      if (x->else_branch_ != nullptr)
+        captured(*x->else_branch_);
+    } else if (auto x{dynamic_cast<const while_stmt *>(&s)})
+      captured(*x->body_);
+  }
+
+  inline static std::atomic<std::size_t> next_slot__{};
+
+  // the names declared by each scope around the current statement, outermost
+  // first. scopes from base_ on belong to the innermost function, or to
+  // blocks at the top level.
+  std::vector<names> scopes_{};
+  std::size_t base_{};
+  // names assigned by the functions declared in the innermost function, and
+  // whether one of them is not parsed yet and so might assign any name.
+  names captured_{};
+  bool opaque_{};
+};
\ No newline at end of file
@@ -1,40 +1,227 @@
-#include "lexer.h"
-#include "parser.h"
+#include "output.h"
+#include "pool.h"
+#include "session.h"
+#include "snapshot.h"
 
+#include <charconv>
 #include <fstream>
+#include <limits>
 #include <iostream>
+#include <span>
+#include <string_view>
 #include <sysexits.h>
 
-void run(std::string source) {
-  lexer l{source};
-  auto tokens{l.scan()};
-  parser p{tokens};
-  auto stmts{p.make_ast()};
+std::string read_source(std::string path) {
+  std::fstream f{path};
+  return {std::istreambuf_iterator{f}, std::istreambuf_iterator<char>{}};
+}
 
-  for (auto &&x : stmts)
-    x->operator()();
+// starts s from the snapshot at image, if one was given.
+bool start(session &s, std::string_view image, bool memoizable = true) {
+  return image.empty() || load_snapshot(std::string{image}, s, memoizable);
 }
 
-void run_prompt() {
-  for (std::string line{}; (std::cout << "> ", std::getline(std::cin, line));)
-    run(line);
+void run_prompt(std::string_view image) {
+  session s{};
+  if (!start(s, image))
+    return;
+  auto &out{standard_output()};
+  for (std::string line{};
+       (out.write("> "), out.flush(), std::getline(std::cin, line));)
+    s.eval(line);
+
+  if (memoize__)
+    report(std::cerr, s.memoized());
 }
 
-void run_file(std::string path) {
-  std::fstream f{path};
-  run(std::string{std::istreambuf_iterator{f},
-                  std::istreambuf_iterator<char>{}});
+void run_file(std::string path, std::string_view image) {
+  session s{};
+  if (!start(s, image))
+    return;
+  s.eval(read_source(path));
+
+  if (memoize__)
+    report(std::cerr, s.memoized());
+}
+
+// runs the prelude at path and saves the global scope it leaves to image.
+void run_prelude(std::string path, std::string_view image) {
+  session s{};
+  token_list tokens{};
+  if (!s.eval(read_source(path), &tokens) ||
+      !save_snapshot(std::string{image}, s, tokens))
+    std::cerr << "no snapshot written" << std::endl;
+}
+
+// parses the script once and runs it against every input concurrently. each
+// run gets a fresh global scope with the input's contents bound to `input`;
+// outputs are written in input order once all runs are done.
+void run_batch(std::string path, std::span<char *> inputs,
+               std::string_view image) {
+  lexer l{read_source(path)};
+  parser p{l.scan()};
+  const auto stmts{p.make_ast()};
+  const auto memoized{memoize__ ? memoize(stmts)
+                                : decltype(memoize(stmts)){}};
+  optimize(stmts);
+
+  std::vector<std::string> outputs(std::size(inputs));
+
+  pool workers{};
+  for (std::size_t i{}; i < std::size(inputs); ++i)
+    workers.submit([&, i] {
+      output o{};
+      out__ = &o;
+
+      // the script was analysed for purity without the snapshot, so the
+      // snapshot's functions can't be memoized against it.
+      session s{};
+      if (start(s, image, false)) {
+        s.globals()->symbols_["input"] = lox_string{read_source(inputs[i])};
+        s.exec(stmts);
+      }
+
+      out__ = &standard_output();
+      outputs[i] = o.take();
+    });
+  workers.wait();
+
+  for (auto &&x : outputs)
+    standard_output().write(x);
+
+  if (memoize__)
+    report(std::cerr, memoized);
+}
+
+[[noreturn]] void usage() {
+  std::cout << "usage: lox [options] [file]\n"
+               "       lox [options] --batch script [inputs...]\n"
+               "options:\n"
+               "  --flush=line|full|none\n"
+               "  --max-depth=n      deepest call nesting (default 2000)\n"
+               "  --memoize[=n]      cache up to n results per pure function\n"
+               "  --lazy-parse       parse function bodies when first called\n"
+               "  --inline=n         inline functions returning up to n nodes\n"
+               "                     (default 16, 0 for none)\n"
+               "  --mem-stats        report memory use by subsystem at exit\n"
+               "  --max-heap=n[k|m|g]  stop scripts holding more than n bytes\n"
+               "  --fuel=n           stop after n loop iterations and calls\n"
+               "  --time-limit=ms    stop scripts running longer than ms\n"
+               "  --snapshot-out=image  run file, save the globals it leaves\n"
+               "  --snapshot-in=image   start from the globals saved in image"
+            << std::endl;
+  exit(EX_USAGE);
+}
+
+bool parse_size(std::string_view s, std::size_t &n) {
+  const auto [last, ec]{std::from_chars(std::begin(s), std::end(s), n)};
+  return ec == std::errc{} && last == std::end(s);
+}
+
+// a size in bytes, or in kibibytes, mebibytes or gibibytes given a k, m or g
+// suffix.
+bool parse_bytes(std::string_view s, std::size_t &n) {
+  int shift{};
+  if (!s.empty())
+    switch (s.back()) {
+    case 'k':
+      shift = 10;
+      break;
+    case 'm':
+      shift = 20;
+      break;
+    case 'g':
+      shift = 30;
+    }
+
+  if (shift != 0)
+    s.remove_suffix(1);
+  if (!parse_size(s, n) || n > std::numeric_limits<std::size_t>::max() >> shift)
+    return false;
+  n <<= shift;
+  return true;
 }
 
 int main(int argc, char **argv) {
-  switch (argc) {
-  default:
-    std::cout << "usage: lox [file]" << std::endl;
-    exit(EX_USAGE);
-  case 1:
-    run_prompt();
-    break;
-  case 2:
-    run_file(argv[1]);
+  std::span args{argv + 1, argv + argc};
+  bool mem_stats{};
+  std::string_view snapshot_in{}, snapshot_out{};
+
+  for (; !args.empty() && std::string_view{args.front()}.starts_with("--") &&
+         std::string_view{args.front()} != "--batch";
+       args = args.subspan(1)) {
+    if (const std::string_view arg{args.front()}; arg == "--flush=line")
+      standard_output().set_policy(flush_policy::line);
+    else if (arg == "--flush=full")
+      standard_output().set_policy(flush_policy::full);
+    else if (arg == "--flush=none")
+      standard_output().set_policy(flush_policy::none);
+    else if (arg.starts_with("--max-depth=")) {
+      if (!parse_size(arg.substr(std::size("--max-depth=") - 1), max_depth__))
+        usage();
+    } else if (arg == "--memoize")
+      memoize__ = true;
+    else if (arg.starts_with("--memoize=")) {
+      memoize__ = true;
+      if (!parse_size(arg.substr(std::size("--memoize=") - 1),
+                      memo_capacity__) ||
+          memo_capacity__ == 0)
+        usage();
+    } else if (arg == "--lazy-parse")
+      lazy_parse__ = true;
+    else if (arg.starts_with("--inline=")) {
+      if (!parse_size(arg.substr(std::size("--inline=") - 1), inline_budget__))
+        usage();
+    } else if (arg == "--mem-stats")
+      mem_stats = mem_tracking__ = true;
+    else if (arg.starts_with("--max-heap=")) {
+      if (!parse_bytes(arg.substr(std::size("--max-heap=") - 1), max_heap__) ||
+          max_heap__ == 0)
+        usage();
+      mem_tracking__ = true;
+    } else if (arg.starts_with("--fuel=")) {
+      if (!parse_size(arg.substr(std::size("--fuel=") - 1), max_fuel__) ||
+          max_fuel__ == 0)
+        usage();
+    } else if (arg.starts_with("--time-limit=")) {
+      std::size_t ms{};
+      if (!parse_size(arg.substr(std::size("--time-limit=") - 1), ms) ||
+          ms == 0)
+        usage();
+      time_limit__ = std::chrono::milliseconds{ms};
+    } else if (arg.starts_with("--snapshot-in="))
+      snapshot_in = arg.substr(std::size("--snapshot-in=") - 1);
+    else if (arg.starts_with("--snapshot-out="))
+      snapshot_out = arg.substr(std::size("--snapshot-out=") - 1);
+    else
+      usage();
+  }
+
+  // a snapshot only records functions by their place in the one program
+  // that ran, so one can't be taken on top of another.
+  if (!snapshot_out.empty()) {
+    if (std::size(args) != 1 || !snapshot_in.empty() ||
+        std::string_view{args.front()} == "--batch")
+      usage();
+    run_prelude(args.front(), snapshot_out);
+  } else if (!args.empty() && std::string_view{args.front()} == "--batch") {
+    if (std::size(args) < 2)
+      usage();
+    run_batch(args[1], args.subspan(2), snapshot_in);
+  } else {
+    switch (std::size(args)) {
+    default:
+      usage();
+    case 0:
+      run_prompt(snapshot_in);
+      break;
+    case 1:
+      run_file(args.front(), snapshot_in);
+    }
+  }
+
+  if (mem_stats) {
+    standard_output().flush();
+    report_memory(std::cerr);
   }
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <iomanip>
+#include <memory>
+#include <new>
+#include <ostream>
+
+// what the interpreter's allocations are charged to.
+enum struct subsystem { tokens, ast, envs, strings, arrays, collections };
+
+constexpr std::size_t subsystems__{6};
+
+// whether allocations are counted at all. set with --mem-stats or
+// --max-heap, before anything is allocated: an object allocated before it
+// is set would be released without having been charged. while it is clear,
+// the counters cost one branch per allocation.
+bool mem_tracking__{};
+
+// bytes the counted subsystems may hold live together before the running
+// program is stopped. zero means no limit. set with --max-heap.
+std::size_t max_heap__{};
+
+// live and peak bytes per subsystem, for --mem-stats or a host embedding
+// the interpreter.
+class memory final {
+public:
+  struct usage final {
+    std::size_t live_{}, peak_{};
+  };
+
+  static void charge(subsystem s, std::size_t n) noexcept {
+    if (!mem_tracking__)
+      return;
+    add(counters__[static_cast<std::size_t>(s)], n);
+    add(counters__[subsystems__], n);
+  }
+
+  static void release(subsystem s, std::size_t n) noexcept {
+    if (!mem_tracking__)
+      return;
+    counters__[static_cast<std::size_t>(s)].live_.fetch_sub(
+        n, std::memory_order_relaxed);
+    counters__[subsystems__].live_.fetch_sub(n, std::memory_order_relaxed);
+  }
+
+  static usage of(subsystem s) noexcept {
+    return load(counters__[static_cast<std::size_t>(s)]);
+  }
+
+  static usage total() noexcept { return load(counters__[subsystems__]); }
+
+  // whether the live total is over max_heap__.
+  static bool exhausted() noexcept {
+    return max_heap__ != 0 &&
+           counters__[subsystems__].live_.load(std::memory_order_relaxed) >
+               max_heap__;
+  }
+
+private:
+  struct counter final {
+    std::atomic<std::size_t> live_, peak_;
+  };
+
+  static void add(counter &c, std::size_t n) noexcept {
+    const auto live{c.live_.fetch_add(n, std::memory_order_relaxed) + n};
+    for (auto peak{c.peak_.load(std::memory_order_relaxed)};
+         live > peak && !c.peak_.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed);)
+      ;
+  }
+
+  static usage load(const counter &c) noexcept {
+    return {c.live_.load(std::memory_order_relaxed),
+            c.peak_.load(std::memory_order_relaxed)};
+  }
+
+  // one per subsystem, then the total.
+  inline static std::array<counter, subsystems__ + 1> counters__{};
+};
+
+void report_memory(std::ostream &os) {
+  constexpr std::array names{"tokens", "ast",    "envs",
+                             "strings", "arrays", "collections"};
+
+  const auto row{[&](const char *name, memory::usage u) {
+    os << std::left << std::setw(12) << name << std::right << std::setw(14)
+       << u.live_ << std::setw(14) << u.peak_ << '\n';
+  }};
+
+  os << std::left << std::setw(12) << "memory" << std::right << std::setw(14)
+     << "live" << std::setw(14) << "peak" << '\n';
+  for (std::size_t i{}; i < subsystems__; ++i)
+    row(names[i], memory::of(static_cast<subsystem>(i)));
+  row("total", memory::total());
+  os << "tokens counts token lists but not the lexemes they hold\n"
+     << std::flush;
+}
+
+// an allocator charging what it allocates to S.
+template <typename T, subsystem S> struct tracked {
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = tracked<U, S>;
+  };
+
+  tracked() = default;
+  template <typename U> tracked(const tracked<U, S> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    memory::charge(S, n * sizeof(T));
+    return std::allocator<T>{}.allocate(n);
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    memory::release(S, n * sizeof(T));
+    std::allocator<T>{}.deallocate(p, n);
+  }
+
+  friend bool operator==(const tracked &, const tracked &) noexcept {
+    return true;
+  }
+};
+
+// charges every object of a class deriving from it to S. the class needs a
+// virtual destructor if objects are deleted through a base pointer.
+template <subsystem S> struct tracked_new {
+  // kept out of line: with only one of the pair inlined, gcc takes the
+  // other for a mismatched deallocation.
+  [[gnu::noinline]] static void *operator new(std::size_t n) {
+    memory::charge(S, n);
+    return ::operator new(n);
+  }
+
+  [[gnu::noinline]] static void operator delete(void *p,
+                                                std::size_t n) noexcept {
+    memory::release(S, n);
+    ::operator delete(p, n);
+  }
+};
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "env.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// results of a pure function by argument list, evicting the least recently
+// used entry once full. only numbers, strings and bools are cached: objects
+// have identity, and errors must be raised again.
+class memo final {
+public:
+  memo(std::size_t capacity) : capacity_{capacity} {}
+
+  static bool cacheable(const value &x) noexcept {
+    return std::holds_alternative<double>(x) ||
+           std::holds_alternative<lox_string>(x) ||
+           std::holds_alternative<bool>(x);
+  }
+
+  std::optional<value> find(const std::vector<value> &args) {
+    std::lock_guard lock{mutex_};
+
+    const auto i{index_.find(args)};
+    if (i == std::end(index_)) {
+      ++misses_;
+      return std::nullopt;
+    }
+
+    ++hits_;
+    entries_.splice(std::begin(entries_), entries_, i->second);
+    return i->second->second;
+  }
+
+  void insert(std::vector<value> args, value result) {
+    std::lock_guard lock{mutex_};
+
+    if (index_.contains(args))
+      return;
+
+    if (std::size(entries_) == capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+
+    entries_.emplace_front(std::move(args), std::move(result));
+    index_.emplace(entries_.front().first, std::begin(entries_));
+  }
+
+  std::size_t hits() const noexcept { return hits_; }
+  std::size_t misses() const noexcept { return misses_; }
+
+private:
+  // numbers are keyed by their bits, so 0 and -0 get entries of their own
+  // and a nan finds the result it was cached with.
+  static std::uint64_t bits(double x) noexcept {
+    return std::bit_cast<std::uint64_t>(x);
+  }
+
+  struct hash final {
+    std::size_t operator()(const std::vector<value> &args) const noexcept {
+      std::size_t h{std::size(args)};
+      for (auto &&x : args)
+        h = h * 31 + (std::holds_alternative<double>(x)
+                          ? std::hash<std::uint64_t>{}(
+                                bits(std::get<double>(x)))
+                          : std::hash<value>{}(x));
+      return h;
+    }
+  };
+
+  struct equal final {
+    bool operator()(const std::vector<value> &x,
+                    const std::vector<value> &y) const noexcept {
+      return std::ranges::equal(x, y, [](const value &a, const value &b) {
+        return std::holds_alternative<double>(a) &&
+                       std::holds_alternative<double>(b)
+                   ? bits(std::get<double>(a)) == bits(std::get<double>(b))
+                   : a == b;
+      });
+    }
+  };
+
+  using entry = std::pair<std::vector<value>, value>;
+
+  const std::size_t capacity_{};
+  std::mutex mutex_{};
+  std::list<entry> entries_{};
+  std::unordered_map<std::vector<value>, std::list<entry>::iterator, hash,
+                     equal>
+      index_{};
+  std::size_t hits_{}, misses_{};
+};
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "expr.h"
+
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+
+// line flushes after every print, full only when the buffer fills up, and
+// none writes every print straight through.
+enum struct flush_policy { line, full, none };
+
+// shortest text that reads back as x. integral values print without an
+// exponent.
+std::string_view format(double x, std::array<char, 32> &buf) noexcept {
+  const auto [last, _]{
+      std::trunc(x) == x && std::abs(x) < 1e16
+          ? std::to_chars(std::begin(buf), std::end(buf), x,
+                          std::chars_format::fixed)
+          : std::to_chars(std::begin(buf), std::end(buf), x)};
+  return {std::begin(buf), last};
+}
+
+std::ostream &operator<<(std::ostream &os, const value v) {
+  if (is_number(v)) {
+    std::array<char, 32> buf{};
+    return os << format(std::get<double>(v), buf);
+  }
+  if (is_string(v))
+    return os << std::get<lox_string>(v);
+  if (is_bool(v))
+    return os << std::get<bool>(v);
+  if (is_object(v))
+    return std::get<std::shared_ptr<object>>(v)->print(os);
+  return os << std::get<expr_error>(v);
+}
+
+// buffered writer behind print. output bound to a file descriptor is
+// written with one writev per flush; unbound output just accumulates until
+// taken.
+class output final {
+public:
+  static constexpr std::size_t capacity__{1 << 18};
+
+  output() = default;
+  output(int fd, flush_policy policy) : fd_{fd}, policy_{policy} {
+    buf_.reserve(capacity__);
+  }
+
+  ~output() { flush(); }
+
+  void set_policy(flush_policy policy) {
+    std::lock_guard lock{mutex_};
+    policy_ = policy;
+    flush_locked();
+  }
+
+  void println(const value &v) {
+    std::lock_guard lock{mutex_};
+
+    if (is_number(v)) {
+      std::array<char, 32> buf{};
+      write_locked(format(std::get<double>(v), buf));
+    } else if (is_string(v)) {
+      write_locked(std::get<lox_string>(v));
+    } else {
+      std::ostringstream os{};
+      os << v;
+      write_locked(std::move(os).str());
+    }
+    write_locked("\n");
+
+    if (policy_ != flush_policy::full)
+      flush_locked();
+  }
+
+  void write(std::string_view s) {
+    std::lock_guard lock{mutex_};
+    write_locked(s);
+    if (policy_ == flush_policy::none)
+      flush_locked();
+  }
+
+  void flush() {
+    std::lock_guard lock{mutex_};
+    flush_locked();
+  }
+
+  std::string take() {
+    std::lock_guard lock{mutex_};
+    return std::exchange(buf_, {});
+  }
+
+private:
+  void write_locked(std::string_view s) {
+    if (fd_ >= 0 && std::size(buf_) + std::size(s) > capacity__) {
+      // too big to buffer: send it along with what is buffered in one call
+      // rather than copying it in.
+      if (std::size(s) >= capacity__) {
+        write_all({iovec{std::data(buf_), std::size(buf_)},
+                   iovec{const_cast<char *>(std::data(s)), std::size(s)}});
+        buf_.clear();
+        return;
+      }
+      flush_locked();
+    }
+    buf_.append(s);
+  }
+
+  void flush_locked() {
+    if (fd_ < 0 || buf_.empty())
+      return;
+    write_all({iovec{std::data(buf_), std::size(buf_)}, iovec{}});
+    buf_.clear();
+  }
+
+  void write_all(std::array<iovec, 2> iov) {
+    for (auto first{std::begin(iov)}; first != std::end(iov);) {
+      const auto n{writev(fd_, first, std::end(iov) - first)};
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+
+      auto left{static_cast<std::size_t>(n)};
+      for (; first != std::end(iov) && left >= first->iov_len; ++first)
+        left -= first->iov_len;
+      if (first != std::end(iov)) {
+        first->iov_base = static_cast<char *>(first->iov_base) + left;
+        first->iov_len -= left;
+      }
+    }
+  }
+
+  int fd_{-1};
+  flush_policy policy_{flush_policy::full};
+  std::mutex mutex_{};
+  std::string buf_{};
+};
+
+// fully buffered unless stdout is a terminal. flushed at exit.
+output &standard_output() {
+  static output out{STDOUT_FILENO, isatty(STDOUT_FILENO)
+                                       ? flush_policy::line
+                                       : flush_policy::full};
+  return out;
+}
\ No newline at end of file
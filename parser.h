@@ -1,14 +1,23 @@
 #pragma once
 
+#include "collection.h"
+#include "loop.h"
 #include "stmt.h"
+#include <algorithm>
 #include <format>
 #include <initializer_list>
 #include <sysexits.h>
 #include <vector>
 
+// whether function bodies are only checked for balanced brackets when first
+// parsed, and parsed in full when first called. set with --lazy-parse.
+bool lazy_parse__{};
+
 class parser final {
 public:
-  parser(std::vector<token> tokens) : tokens_{tokens} {}
+  // diagnostics go to diag.
+  parser(token_list tokens, std::ostream &diag = std::cerr)
+      : tokens_{std::move(tokens)}, diag_{diag} {}
 
   std::vector<std::unique_ptr<stmt>> make_ast() {
     parse();
@@ -30,7 +39,18 @@ public:
                                       : statement();
   }
 
+  // parses the declaration starting at token first on its own: error_ and
+  // seen_ only cover it afterwards. a snapshot restores each function this
+  // way from its program's tokens.
+  std::unique_ptr<stmt> declaration_at(token_list::size_type first) {
+    current_ = seen_ = first;
+    error_ = error_stmt_ = false;
+    return declaration();
+  }
+
   std::unique_ptr<stmt> fun_declaration() {
+    // the fun keyword has been matched already.
+    const auto first{current_ - 1};
     if (!consume(token_type::identifier__))
       return panic<stmt>();
 
@@ -56,10 +76,90 @@ public:
         return panic<stmt>();
     }
 
-    auto body{block_statement()};
+    if (!consume(token_type::l_brace__))
+      return panic<stmt>();
+
+    std::unique_ptr<stmt> body{};
+    std::unique_ptr<lazy_body> lazy{};
+    if (lazy_parse__) {
+      if ((lazy = preparse_body()) == nullptr)
+        return panic<stmt>();
+    } else {
+      ++fun_depth_;
+      body = block_statement();
+      --fun_depth_;
+    }
+
+    auto f{std::make_unique<fun_stmt>(std::move(name), std::move(params),
+                                      std::move(body))};
+    f->lazy_ = std::move(lazy);
+    f->first_ = base_ + first;
+    f->last_ = base_ + current_;
+    return std::move(f);
+  }
+
+  // skips a function body after its '{', only checking that its brackets
+  // balance, and keeps its tokens to parse it from later.
+  std::unique_ptr<lazy_body> preparse_body() {
+    using enum token_type;
+    const auto first{current_ - 1};
+    std::vector<token_type> closers{r_brace__};
+
+    // only the types are looked at, without copying the tokens.
+    for (; !closers.empty();) {
+      if (tokens_[current_].type_ == eof__) {
+        diag_ << "unclosed block." << std::endl;
+        return nullptr;
+      }
+      switch (const auto type{tokens_[current_++].type_}; type) {
+      default:
+        break;
+      case l_brace__:
+        closers.push_back(r_brace__);
+        break;
+      case l_paren__:
+        closers.push_back(r_paren__);
+        break;
+      case l_bracket__:
+        closers.push_back(r_bracket__);
+        break;
+      case r_brace__:
+        [[fallthrough]];
+      case r_paren__:
+        [[fallthrough]];
+      case r_bracket__:
+        if (type != closers.back()) {
+          diag_ << "expected " << closers.back() << ", got " << type
+                << std::endl;
+          return nullptr;
+        }
+        closers.pop_back();
+      }
+    }
+
+    auto lazy{std::make_unique<lazy_body>()};
+    lazy->first_ = base_ + first;
+    for (auto i{first}; i < current_; ++i) {
+      const auto &x{tokens_[i]};
+      if (x.type_ == identifier__ &&
+          (tokens_[i + 1].type_ == equal__ || tokens_[i - 1].type_ == var__ ||
+           tokens_[i - 1].type_ == fun__))
+        lazy->binds_.push_back(symbol::intern(x.lexeme_));
+      if (x.type_ == string__)
+        lazy->source_.append(1, '"').append(x.lexeme_).append("\" ");
+      else
+        lazy->source_.append(x.lexeme_).append(1, ' ');
+    }
+    return lazy;
+  }
 
-    return std::make_unique<fun_stmt>(std::move(name), std::move(params),
-                                      std::move(body));
+  // parses the tokens of a body left for later, lexed again from its
+  // source. null if they do not parse.
+  std::unique_ptr<stmt> body() {
+    current_ = 1;
+    fun_depth_ = 1;
+    auto b{block_statement()};
+    return error_ || !is_end() ? nullptr : std::move(b);
   }
 
   std::unique_ptr<stmt> var_declaration() {
@@ -77,12 +177,13 @@ public:
 
   std::unique_ptr<stmt> statement() {
     using enum token_type;
-    return match(l_brace__) ? block_statement()
-           : match(for__)   ? for_statement()
-           : match(if__)    ? if_statement()
-           : match(print__) ? print_statement()
-           : match(while__) ? while_statement()
-                            : expr_statement();
+    return match(l_brace__)  ? block_statement()
+           : match(for__)    ? for_statement()
+           : match(if__)     ? if_statement()
+           : match(print__)  ? print_statement()
+           : match(return__) ? return_statement()
+           : match(while__)  ? while_statement()
+                             : expr_statement();
   }
 
   std::unique_ptr<stmt> block_statement() {
@@ -92,7 +193,7 @@ public:
       block->stmts_.push_back(declaration());
 
     if (prev().type_ != token_type::r_brace__) {
-      std::cerr << "unclosed block." << std::endl;
+      diag_ << "unclosed block." << std::endl;
       return panic<stmt>();
     }
 
@@ -156,6 +257,19 @@ public:
     return std::move(s);
   }
 
+  std::unique_ptr<stmt> return_statement() {
+    if (fun_depth_ == 0) {
+      diag_ << "return outside function." << std::endl;
+      return panic<stmt>();
+    }
+
+    auto s{std::make_unique<return_stmt>(
+        peek().type_ == token_type::semi__ ? nullptr : expression())};
+    if (!error_stmt_ && !consume(token_type::semi__))
+      return panic<stmt>();
+    return std::move(s);
+  }
+
   std::unique_ptr<stmt> while_statement() {
     if (!consume(token_type::l_paren__))
       return panic<stmt>();
@@ -198,8 +312,11 @@ public:
 
       if (lhs->lvalue())
         return std::make_unique<assign_expr>(lhs->identifier(), std::move(rhs));
+      if (auto x{dynamic_cast<index_expr *>(lhs.get())})
+        return std::make_unique<index_assign_expr>(
+            std::move(x->object_), std::move(x->key_), std::move(rhs));
 
-      std::cerr << "cannot assign to rvalue." << std::endl;
+      diag_ << "cannot assign to rvalue." << std::endl;
     }
 
     return std::move(lhs);
@@ -260,16 +377,29 @@ public:
 
   std::unique_ptr<expr> unary() {
     using enum token_type;
-    return match({bang__, minus__})
-               ? std::make_unique<unary_expr>(prev(), unary())
-               : call();
+    if (!match({bang__, minus__}))
+      return call();
+
+    // the operator has to be taken before parsing the operand moves past it.
+    auto op{prev()};
+    return std::make_unique<unary_expr>(op, unary());
   }
 
   std::unique_ptr<expr> call() {
     using enum token_type;
     auto lhs{primary()};
 
-    for (; match(l_paren__);) {
+    for (; !error_stmt_ && match({l_paren__, l_bracket__});) {
+      if (prev().type_ == l_bracket__) {
+        auto key{assign()};
+        if (error_stmt_)
+          return {};
+        if (!consume(r_bracket__))
+          return panic<expr>();
+        lhs = std::make_unique<index_expr>(std::move(lhs), std::move(key));
+        continue;
+      }
+
       auto c{std::make_unique<call_expr>(std::move(lhs))};
       if (!match(r_paren__)) {
         c->args_.push_back(assign());
@@ -293,6 +423,11 @@ public:
     if (match(identifier__))
       return std::make_unique<var_expr>(prev());
 
+    if (match(unknown__)) {
+      diag_ << "unexpected character '" << prev().lexeme_ << "'." << std::endl;
+      return panic<expr>();
+    }
+
     if (match(l_paren__)) {
       auto e{expression()};
 
@@ -305,10 +440,59 @@ public:
       return panic<expr>();
     }
 
-    std::cerr << "expected expression." << std::endl;
+    if (match(l_bracket__))
+      return collection();
+
+    diag_ << "expected expression." << std::endl;
     return panic<expr>();
   }
 
+  // a list or map literal, after its '['. the first item decides which: a
+  // map's entries have a ':' between key and value.
+  std::unique_ptr<expr> collection() {
+    using enum token_type;
+
+    if (match(colon__)) {
+      if (!consume(r_bracket__))
+        return panic<expr>();
+      return std::make_unique<map_expr>();
+    }
+    if (match(r_bracket__))
+      return std::make_unique<list_expr>();
+
+    auto first{assign()};
+    if (error_stmt_)
+      return {};
+
+    if (!match(colon__)) {
+      auto l{std::make_unique<list_expr>()};
+      l->items_.push_back(std::move(first));
+      for (; !error_stmt_ && match(comma__);)
+        l->items_.push_back(assign());
+      if (error_stmt_)
+        return {};
+      if (!consume(r_bracket__))
+        return panic<expr>();
+      return std::move(l);
+    }
+
+    auto m{std::make_unique<map_expr>()};
+    m->entries_.emplace_back(std::move(first), assign());
+    for (; !error_stmt_ && match(comma__);) {
+      auto k{assign()};
+      if (error_stmt_)
+        return {};
+      if (!consume(colon__))
+        return panic<expr>();
+      m->entries_.emplace_back(std::move(k), assign());
+    }
+    if (error_stmt_)
+      return {};
+    if (!consume(r_bracket__))
+      return panic<expr>();
+    return std::move(m);
+  }
+
   void synchronize() {
     using enum token_type;
     for (; !is_end() && next().type_ != semi__;) {
@@ -345,7 +529,7 @@ public:
   bool consume(token_type type) {
     if (match(type))
       return true;
-    std::cerr << "expected " << type << ", got " << peek().type_ << std::endl;
+    diag_ << "expected " << type << ", got " << peek().type_ << std::endl;
     return false;
   }
 
@@ -362,11 +546,35 @@ public:
 
   token prev() const noexcept { return tokens_[current_ - 1]; }
   token next() { return tokens_[current_++]; }
-  token peek() const noexcept { return tokens_[current_]; }
+  token peek() const noexcept {
+    seen_ = std::max(seen_, current_);
+    return tokens_[current_];
+  }
   bool is_end() const noexcept { return peek().type_ == token_type::eof__; }
 
   bool error_{}, error_stmt_{};
-  std::vector<token> tokens_{};
-  std::vector<token>::size_type current_{};
+  int fun_depth_{};
+  token_list tokens_{};
+  token_list::size_type current_{};
+  // where tokens_ sit in the program's tokens, when they are a body's.
+  token_list::size_type base_{};
+  // the furthest token looked at, so whoever parses part of a file can tell
+  // whether what follows the part could have changed the parse.
+  mutable token_list::size_type seen_{};
+  std::ostream &diag_;
   std::vector<std::unique_ptr<stmt>> stmts_{};
-};
\ No newline at end of file
+};
+
+const block_stmt *fun_stmt::body() const noexcept {
+  if (lazy_ != nullptr)
+    std::call_once(lazy_->parsed_, [&] {
+      lexer l{{std::begin(lazy_->source_), std::end(lazy_->source_)}};
+      lazy_->source_ = {};
+      parser p{l.scan()};
+      p.base_ = lazy_->first_;
+      if ((body_ = p.body()) != nullptr)
+        loop_optimizer{}(params_, *body_);
+    });
+  // the parser only gives functions block bodies.
+  return static_cast<const block_stmt *>(body_.get());
+}
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing thread pool. each worker owns a deque; it pops its own work
+// from the back and steals from the front of the others when it runs dry.
+class pool final {
+public:
+  pool(unsigned n = std::max(1u, std::thread::hardware_concurrency()))
+      : queues_(n) {
+    for (unsigned i{}; i < n; ++i)
+      threads_.emplace_back([this, i](std::stop_token stop) { work(stop, i); });
+  }
+
+  // blocked threads give up waiting, so shutdown never hangs on a task that
+  // waits for good.
+  ~pool() {
+    {
+      std::lock_guard lock{mutex_};
+      stopping_ = true;
+      for (auto &&t : threads_)
+        t.request_stop();
+    }
+    cv_.notify_all();
+  }
+
+  void submit(std::function<void()> task) {
+    const auto i{owner__ == this ? self__ : next_++ % std::size(queues_)};
+    ++pending_;
+
+    {
+      std::lock_guard lock{queues_[i].mutex_};
+      queues_[i].tasks_.push_back(std::move(task));
+    }
+
+    {
+      std::lock_guard lock{mutex_};
+      ++queued_;
+    }
+    cv_.notify_one();
+  }
+
+  // runs queued tasks on the calling thread until done() holds, so a thread
+  // waiting on other tasks never sits idle while there is work to steal.
+  template <typename F> void help_until(F &&done) {
+    for (; !done();)
+      if (!run_one()) {
+        std::unique_lock lock{mutex_};
+        cv_.wait(lock, [&] { return queued_ > 0 || done(); });
+      }
+  }
+
+  void wait() {
+    help_until([this] { return pending_ == 0; });
+  }
+
+  // blocks the calling thread until done() holds without running other
+  // tasks, which could themselves wait on the caller. a blocked worker is
+  // made up for with a spare thread if no other worker is idle, up to
+  // max_spares__ of them; past that, queued tasks wait for a blocked worker
+  // to come back. a spare retires once the worker it stood in for is back,
+  // so threads only grow with the tasks blocked at once. done() is checked
+  // again at least every poll__, so it may depend on the clock. returns
+  // false if the pool shuts down first.
+  template <typename F> bool block_until(F &&done) {
+    std::unique_lock lock{mutex_};
+
+    if (done())
+      return true;
+
+    const auto worker{owner__ == this};
+    if (worker && ++blocked_ > spares_ && idle_ == 0 &&
+        spares_ < max_spares__ && !stopping_)
+      add_spare();
+
+    auto ok{false};
+    for (; !stopping_ && !(ok = done());)
+      cv_.wait_for(lock, poll__);
+
+    if (worker && --blocked_ < spares_)
+      cv_.notify_all();
+    return ok;
+  }
+
+  // wakes every waiting thread so it rechecks its condition. call after
+  // changing state that a condition depends on.
+  void notify() {
+    {
+      std::lock_guard lock{mutex_};
+    }
+    cv_.notify_all();
+  }
+
+private:
+  static constexpr std::chrono::milliseconds poll__{10};
+  static constexpr std::size_t max_spares__{256};
+
+  struct queue final {
+    std::mutex mutex_{};
+    std::deque<std::function<void()>> tasks_{};
+  };
+
+  bool run_one() {
+    const auto self{owner__ == this ? self__ : 0};
+
+    for (std::size_t k{}; k < std::size(queues_); ++k) {
+      auto &q{queues_[(self + k) % std::size(queues_)]};
+      std::unique_lock lock{q.mutex_};
+
+      if (q.tasks_.empty())
+        continue;
+
+      auto task{k == 0 ? std::move(q.tasks_.back())
+                       : std::move(q.tasks_.front())};
+      k == 0 ? q.tasks_.pop_back() : q.tasks_.pop_front();
+      lock.unlock();
+      --queued_;
+
+      task();
+
+      --pending_;
+      notify();
+      return true;
+    }
+
+    return false;
+  }
+
+  // starts a spare in the slot of one that retired, if any. the caller holds
+  // mutex_.
+  void add_spare() {
+    ++spares_;
+    auto slot{std::size(threads_)};
+    if (retired_.empty())
+      threads_.emplace_back();
+    else {
+      slot = retired_.back();
+      retired_.pop_back();
+    }
+    // replacing a retired spare joins it, and it has already returned.
+    threads_[slot] = std::jthread{
+        [this, slot](std::stop_token stop) { work(stop, slot); }};
+  }
+
+  // runs tasks on the thread in slot. the slots past one per queue are
+  // spares, which retire when idle while more spares run than workers are
+  // blocked.
+  void work(std::stop_token stop, std::size_t slot) {
+    owner__ = this;
+    self__ = slot % std::size(queues_);
+    const auto spare{slot >= std::size(queues_)};
+    const auto surplus{[&] { return spare && spares_ > blocked_; }};
+
+    for (; !stop.stop_requested();)
+      if (!run_one()) {
+        std::unique_lock lock{mutex_};
+        if (surplus()) {
+          --spares_;
+          retired_.push_back(slot);
+          return;
+        }
+        ++idle_;
+        cv_.wait(lock, stop, [&] { return queued_ > 0 || surplus(); });
+        --idle_;
+      }
+  }
+
+  static inline thread_local pool *owner__{};
+  static inline thread_local std::size_t self__{};
+
+  std::vector<queue> queues_;
+  std::atomic<std::size_t> next_{}, pending_{}, queued_{};
+  std::mutex mutex_{};
+  std::size_t idle_{}, blocked_{}, spares_{};
+  bool stopping_{};
+  std::vector<std::size_t> retired_{};
+  std::condition_variable_any cv_{};
+  std::vector<std::jthread> threads_{};
+};
\ No newline at end of file
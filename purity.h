@@ -0,0 +1,250 @@
+#pragma once
+
+#include "collection.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+// whether calls to pure functions are memoized, and how many results each
+// one keeps. set with --memoize[=n].
+bool memoize__{};
+std::size_t memo_capacity__{1 << 16};
+
+// proves top-level functions pure: the result depends on nothing but the
+// arguments, and the call has no effect anyone can observe. a pure function
+// may read its own locals, assign them, and call pure functions. anything
+// the analysis cannot see through, such as reading a global, calling a
+// function value or declaring a closure, makes the function impure.
+class purity final {
+public:
+  using names = std::unordered_set<std::string>;
+
+  // functions named in known are taken to be pure already.
+  purity(names known) : candidates_{std::move(known)} {}
+
+  // returns the pure functions declared at the top level of stmts.
+  std::unordered_map<std::string, fun_stmt *>
+  operator()(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    std::unordered_map<std::string, fun_stmt *> found{};
+    names declared{};
+
+    // a top-level name bound twice, or ever assigned, can't be trusted to
+    // still mean the function when it is called.
+    for (auto &&x : stmts) {
+      if (auto f{dynamic_cast<fun_stmt *>(x.get())}) {
+        if (!declared.insert(f->name_.lexeme_).second)
+          found.erase(f->name_.lexeme_);
+        else
+          found[f->name_.lexeme_] = f;
+      } else if (auto d{dynamic_cast<const decl_stmt *>(x.get())}) {
+        declared.insert(d->identifier_.lexeme_);
+        found.erase(d->identifier_.lexeme_);
+      }
+    }
+
+    for (auto &&x : assigned(stmts))
+      found.erase(x), candidates_.erase(x);
+
+    for (auto &&[name, _] : found)
+      candidates_.insert(name);
+
+    // drop candidates that do something impure or call a dropped one, until
+    // none are left to drop. what remains, recursion included, is pure.
+    for (auto changed{true}; changed;) {
+      changed = false;
+      for (auto i{std::begin(found)}; i != std::end(found);)
+        if (!pure(*i->second)) {
+          candidates_.erase(i->first);
+          i = found.erase(i);
+          changed = true;
+        } else {
+          ++i;
+        }
+    }
+
+    return found;
+  }
+
+  // every name stmts assign to or declare below the top level.
+  static names assigned(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    names out{};
+    for (auto &&x : stmts)
+      assigned(*x, out, true);
+    return out;
+  }
+
+  // every name stmts bind anywhere, top level included.
+  static names rebinds(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    auto out{assigned(stmts)};
+    for (auto &&x : stmts)
+      if (auto f{dynamic_cast<const fun_stmt *>(x.get())})
+        out.insert(f->name_.lexeme_);
+      else if (auto d{dynamic_cast<const decl_stmt *>(x.get())})
+        out.insert(d->identifier_.lexeme_);
+    return out;
+  }
+
+  // adds the names s assigns or declares to out, leaving out its own
+  // declaration if s is at the top level.
+  static void assigned(const stmt &s, names &out, bool top) {
+    if (auto x{dynamic_cast<const block_stmt *>(&s)})
+      for (auto &&y : x->stmts_)
+        assigned(*y, out, false);
+    else if (auto x{dynamic_cast<const decl_stmt *>(&s)}) {
+      if (!top)
+        out.insert(x->identifier_.lexeme_);
+      if (x->value_ != nullptr)
+        assigned(*x->value_, out);
+    } else if (auto x{dynamic_cast<const expr_stmt *>(&s)})
+      assigned(*x->expr_, out);
+    else if (auto x{dynamic_cast<const fun_stmt *>(&s)}) {
+      if (!top)
+        out.insert(x->name_.lexeme_);
+      // a body left for later is not parsed for this, and one that does
+      // not parse never runs.
+      if (x->lazy_ != nullptr)
+        for (auto &&y : x->lazy_->binds_)
+          out.insert(y->str());
+      else if (x->body_ != nullptr)
+        assigned(*x->body_, out, false);
+    } else if (auto x{dynamic_cast<const if_stmt *>(&s)}) {
+      assigned(*x->condition_, out);
+      assigned(*x->if_branch_, out, false);
+      if (x->else_branch_ != nullptr)
+        assigned(*x->else_branch_, out, false);
+    } else if (auto x{dynamic_cast<const print_stmt *>(&s)})
+      assigned(*x->expr_, out);
+    else if (auto x{dynamic_cast<const return_stmt *>(&s)}) {
+      if (x->value_ != nullptr)
+        assigned(*x->value_, out);
+    } else if (auto x{dynamic_cast<const while_stmt *>(&s)}) {
+      assigned(*x->condition_, out);
+      assigned(*x->body_, out, false);
+    }
+  }
+
+  static void assigned(const expr &e, names &out) {
+    if (auto x{dynamic_cast<const assign_expr *>(&e)}) {
+      out.insert(x->identifier_.lexeme_);
+      assigned(*x->rhs_, out);
+    } else if (auto x{dynamic_cast<const binary_expr *>(&e)}) {
+      assigned(*x->lhs_, out);
+      assigned(*x->rhs_, out);
+    } else if (auto x{dynamic_cast<const call_expr *>(&e)}) {
+      assigned(*x->callee_, out);
+      for (auto &&y : x->args_)
+        assigned(*y, out);
+    } else if (auto x{dynamic_cast<const grouping_expr *>(&e)})
+      assigned(*x->body_, out);
+    else if (auto x{dynamic_cast<const index_expr *>(&e)}) {
+      assigned(*x->object_, out);
+      assigned(*x->key_, out);
+    } else if (auto x{dynamic_cast<const index_assign_expr *>(&e)}) {
+      assigned(*x->object_, out);
+      assigned(*x->key_, out);
+      assigned(*x->rhs_, out);
+    } else if (auto x{dynamic_cast<const list_expr *>(&e)}) {
+      for (auto &&y : x->items_)
+        assigned(*y, out);
+    } else if (auto x{dynamic_cast<const map_expr *>(&e)}) {
+      for (auto &&[k, v] : x->entries_)
+        assigned(*k, out), assigned(*v, out);
+    } else if (auto x{dynamic_cast<const unary_expr *>(&e)})
+      assigned(*x->rhs_, out);
+  }
+
+private:
+  bool pure(const fun_stmt &f) const {
+    // proving a body left for later pure would mean parsing it now.
+    if (f.lazy_ != nullptr)
+      return false;
+
+    names locals{};
+    for (auto &&x : f.params_)
+      locals.insert(x.lexeme_);
+    return pure(*f.body_, locals);
+  }
+
+  // locals is the set of names declared in the function so far, by scope.
+  bool pure(const stmt &s, names &locals) const {
+    if (auto x{dynamic_cast<const block_stmt *>(&s)}) {
+      auto scope{locals};
+      return std::ranges::all_of(
+          x->stmts_, [&](auto &&y) { return pure(*y, scope); });
+    }
+    if (auto x{dynamic_cast<const decl_stmt *>(&s)}) {
+      if (x->value_ != nullptr && !pure(*x->value_, locals))
+        return false;
+      locals.insert(x->identifier_.lexeme_);
+      return true;
+    }
+    if (auto x{dynamic_cast<const expr_stmt *>(&s)})
+      return pure(*x->expr_, locals);
+    if (auto x{dynamic_cast<const if_stmt *>(&s)})
+      return pure(*x->condition_, locals) && pure(*x->if_branch_, locals) &&
+             (x->else_branch_ == nullptr || pure(*x->else_branch_, locals));
+    if (auto x{dynamic_cast<const return_stmt *>(&s)})
+      return x->value_ == nullptr || pure(*x->value_, locals);
+    if (auto x{dynamic_cast<const while_stmt *>(&s)})
+      return pure(*x->condition_, locals) && pure(*x->body_, locals);
+    return false;
+  }
+
+  bool pure(const expr &e, const names &locals) const {
+    if (auto x{dynamic_cast<const assign_expr *>(&e)})
+      return locals.contains(x->identifier_.lexeme_) &&
+             pure(*x->rhs_, locals);
+    if (auto x{dynamic_cast<const binary_expr *>(&e)})
+      return pure(*x->lhs_, locals) && pure(*x->rhs_, locals);
+    if (auto x{dynamic_cast<const call_expr *>(&e)}) {
+      const auto callee{dynamic_cast<const var_expr *>(x->callee_.get())};
+      return callee != nullptr &&
+             !locals.contains(callee->identifier_.lexeme_) &&
+             candidates_.contains(callee->identifier_.lexeme_) &&
+             std::ranges::all_of(x->args_,
+                                 [&](auto &&y) { return pure(*y, locals); });
+    }
+    if (auto x{dynamic_cast<const grouping_expr *>(&e)})
+      return pure(*x->body_, locals);
+    // reading an element is pure, but storing one may change an object the
+    // caller can see.
+    if (auto x{dynamic_cast<const index_expr *>(&e)})
+      return pure(*x->object_, locals) && pure(*x->key_, locals);
+    if (auto x{dynamic_cast<const list_expr *>(&e)})
+      return std::ranges::all_of(x->items_,
+                                 [&](auto &&y) { return pure(*y, locals); });
+    if (auto x{dynamic_cast<const map_expr *>(&e)})
+      return std::ranges::all_of(x->entries_, [&](auto &&y) {
+        return pure(*y.first, locals) && pure(*y.second, locals);
+      });
+    if (dynamic_cast<const literal_expr *>(&e))
+      return true;
+    if (auto x{dynamic_cast<const unary_expr *>(&e)})
+      return pure(*x->rhs_, locals);
+    if (auto x{dynamic_cast<const var_expr *>(&e)})
+      return locals.contains(x->identifier_.lexeme_) ||
+             candidates_.contains(x->identifier_.lexeme_);
+    return false;
+  }
+
+  names candidates_{};
+};
+
+// turns on memoization for the pure functions declared at the top level of
+// stmts, and returns them. functions named in known are taken to be pure
+// already.
+std::unordered_map<std::string, fun_stmt *>
+memoize(const std::vector<std::unique_ptr<stmt>> &stmts,
+        purity::names known = {}) {
+  auto pure{purity{std::move(known)}(stmts)};
+  for (auto &&[_, f] : pure)
+    f->memo_ = std::make_unique<memo>(memo_capacity__);
+  return pure;
+}
+
+void report(std::ostream &os,
+            const std::unordered_map<std::string, fun_stmt *> &pure) {
+  for (auto &&[name, f] : pure)
+    os << "memo " << name << ": " << f->memo_->hits() << " hits, "
+       << f->memo_->misses() << " misses" << std::endl;
+}
\ No newline at end of file
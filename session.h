@@ -0,0 +1,157 @@
+#pragma once
+
+#include "array.h"
+#include "collection.h"
+#include "inline.h"
+#include "io.h"
+#include "lexer.h"
+#include "parser.h"
+#include "purity.h"
+#include "task.h"
+
+// the scope every program starts in, with the natives bound.
+std::shared_ptr<env> make_globals() {
+  auto globals{make_env()};
+  globals->symbols_["clock"] = std::make_shared<struct clock>();
+  globals->symbols_["spawn"] = std::make_shared<struct spawn>();
+  globals->symbols_["join"] = std::make_shared<struct join>();
+  globals->symbols_["chan"] = std::make_shared<struct chan>();
+  globals->symbols_["send"] = std::make_shared<struct send>();
+  globals->symbols_["recv"] = std::make_shared<struct recv>();
+  globals->symbols_["read"] = std::make_shared<read_file>();
+  globals->symbols_["write"] = std::make_shared<write_file>();
+  globals->symbols_["dial"] = std::make_shared<struct dial>();
+  globals->symbols_["serve"] = std::make_shared<struct serve>();
+  globals->symbols_["array"] = std::make_shared<make_array>();
+  globals->symbols_["sum"] = std::make_shared<array_sum>();
+  globals->symbols_["min"] = std::make_shared<array_min>();
+  globals->symbols_["max"] = std::make_shared<array_max>();
+  globals->symbols_["dot"] = std::make_shared<array_dot>();
+  globals->symbols_["add"] = std::make_shared<array_add>();
+  globals->symbols_["scale"] = std::make_shared<array_scale>();
+  globals->symbols_["map"] = std::make_shared<array_map>();
+  globals->symbols_["len"] = std::make_shared<length>();
+  globals->symbols_["get"] = std::make_shared<get_item>();
+  globals->symbols_["set"] = std::make_shared<set_item>();
+  globals->symbols_["push"] = std::make_shared<list_push>();
+  globals->symbols_["pop"] = std::make_shared<list_pop>();
+  globals->symbols_["keys"] = std::make_shared<map_keys>();
+  globals->symbols_["values"] = std::make_shared<map_values>();
+  globals->symbols_["has"] = std::make_shared<map_has>();
+  globals->symbols_["remove"] = std::make_shared<map_remove>();
+  return globals;
+}
+
+// state that outlives a single evaluation: the global scope, and the parts
+// of earlier programs that functions still defined may point into. each
+// eval only lexes and parses its own source.
+class session final {
+public:
+  session() : globals_{make_globals()} {}
+
+  // tasks still running are stopped, and waited for, before the functions
+  // they run are freed.
+  ~session() {
+    budget_->cancel();
+    budget_->wait();
+  }
+
+  // returns false if source does not parse, in which case nothing runs, or
+  // if it stops with an error. tokens, if given, gets what source lexed to.
+  bool eval(std::string source, token_list *tokens = nullptr) {
+    lexer l{std::move(source)};
+    parser p{l.scan()};
+    auto stmts{p.make_ast()};
+    if (tokens != nullptr)
+      *tokens = std::move(p.tokens_);
+
+    if (p.error_)
+      return false;
+
+    if (memoize__)
+      prepare(stmts);
+    optimize(stmts);
+
+    const auto ok{exec(stmts)};
+
+    for (auto &&x : stmts)
+      if (x->declares_function())
+        retained_.push_back(std::move(x));
+
+    return ok;
+  }
+
+  // runs an already parsed program, which must outlive the session if it
+  // declares functions. returns false if the program was stopped by an
+  // error.
+  bool exec(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    budget_->start(max_fuel__, time_limit__);
+    charge_to(budget_);
+
+    for (auto &&x : stmts)
+      if (x->operator()(globals_), halted())
+        break;
+
+    // drops the program's pending i/o instead if it already failed.
+    io_loop().run();
+
+    charge_to(nullptr);
+
+    if (!error__.has_value())
+      return true;
+
+    out__->flush();
+    std::cerr << "error: " << *error__ << std::endl;
+    error__.reset();
+    return false;
+  }
+
+  // keeps function declarations parsed outside eval, as a snapshot's are,
+  // optimized like a program's. top says they are bound by name in the
+  // global scope, so they may be memoized like a program's own.
+  void adopt(std::vector<std::unique_ptr<stmt>> stmts, bool top) {
+    if (top && memoize__)
+      prepare(stmts);
+    optimize(stmts);
+    for (auto &&x : stmts)
+      retained_.push_back(std::move(x));
+  }
+
+  // stops the program running in the session, from any thread. it fails
+  // with an error at its next loop iteration or call.
+  void interrupt() noexcept { budget_->interrupt(); }
+
+  std::shared_ptr<env> globals() const noexcept { return globals_; }
+
+  const std::unordered_map<std::string, fun_stmt *> &
+  memoized() const noexcept {
+    return memoized_;
+  }
+
+private:
+  // memoizes the pure functions stmts declares. if stmts rebinds the name of
+  // a function memoized earlier, whatever relied on it may no longer be
+  // pure, so memoization starts over.
+  void prepare(const std::vector<std::unique_ptr<stmt>> &stmts) {
+    const auto rebound{purity::rebinds(stmts)};
+    if (std::ranges::any_of(memoized_, [&](auto &&x) {
+          return rebound.contains(x.first);
+        })) {
+      for (auto &&[_, f] : memoized_)
+        f->memo_.reset();
+      memoized_.clear();
+    }
+
+    purity::names known{};
+    for (auto &&[name, _] : memoized_)
+      known.insert(name);
+
+    memoized_.merge(memoize(stmts, std::move(known)));
+  }
+
+  std::shared_ptr<env> globals_{};
+  // shared with the tasks the program spawns.
+  std::shared_ptr<budget> budget_{std::make_shared<budget>()};
+  std::unordered_map<std::string, fun_stmt *> memoized_{};
+  std::vector<std::unique_ptr<stmt>> retained_{};
+};
\ No newline at end of file
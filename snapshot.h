@@ -0,0 +1,471 @@
+#pragma once
+
+#include "session.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <typeindex>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// a session's global scope saved once its prelude has run, so later runs can
+// start from it instead of running the prelude again. the image holds the
+// prelude's tokens, the token range of each function declaration a value
+// refers to, and every scope and object reachable from the globals, which
+// refer to each other by number rather than address:
+//
+//   magic, tokens, declarations, scope and object counts,
+//   object kinds, scopes, object contents
+//
+// loading maps the file, rebuilds the values and parses each declaration
+// once; no statement of the prelude runs again. natives are saved by name and
+// bound to the loading session's own. tasks, channels and other natives'
+// state can't be saved. slots hoisted out of loops are left out. numbers are
+// written in the host's byte order, so an image only loads on the kind of
+// machine that wrote it.
+constexpr std::string_view snapshot_magic__{"loxsnap\2", 8};
+
+enum struct snapshot_tag : std::uint8_t {
+  number,
+  string,
+  boolean,
+  error,
+  object
+};
+
+enum struct snapshot_kind : std::uint8_t { list, map, array, function, native };
+
+class snapshot_writer final {
+public:
+  // tokens are those of the one program s has run.
+  snapshot_writer(const session &s, const token_list &tokens)
+      : session_{s}, tokens_{tokens} {
+    make_globals()->symbols_.for_each([&](const symbol *k, const value &v) {
+      if (is_object(v))
+        natives_.emplace(typeid(*std::get<std::shared_ptr<object>>(v)),
+                         k->str());
+    });
+  }
+
+  // returns false, having said why, if something can't be saved.
+  bool operator()(const std::string &path) {
+    number(session_.globals());
+    for (std::size_t e{}, o{};
+         e < std::size(envs_) || o < std::size(objects_);)
+      if (e < std::size(envs_))
+        scan(*envs_[e++]);
+      else if (!scan(*objects_[o++]))
+        return false;
+
+    out_.append(snapshot_magic__);
+
+    put<std::uint64_t>(std::size(tokens_));
+    for (auto &&x : tokens_) {
+      put(static_cast<std::uint8_t>(x.type_));
+      put<std::int32_t>(x.line_);
+      put_string(x.lexeme_);
+    }
+
+    put<std::uint64_t>(std::size(decls_));
+    for (auto x : decls_) {
+      put<std::uint64_t>(x->first_);
+      put<std::uint64_t>(x->last_);
+    }
+
+    put<std::uint64_t>(std::size(envs_));
+    put<std::uint64_t>(std::size(objects_));
+
+    for (auto &&x : objects_) {
+      put(kind(*x));
+      if (kind(*x) == snapshot_kind::native)
+        put_string(natives_.at(typeid(*x)));
+    }
+
+    for (auto &&x : envs_) {
+      put<std::uint64_t>(x->prev_ == nullptr ? 0
+                                              : env_ids_[x->prev_.get()] + 1);
+      std::uint64_t n{};
+      x->symbols_.for_each(
+          [&](const symbol *k, const value &) { n += saved(k); });
+      put(n);
+      x->symbols_.for_each([&](const symbol *k, const value &v) {
+        if (saved(k))
+          put_string(k->str()), put_value(v);
+      });
+    }
+
+    for (auto &&x : objects_)
+      put_contents(*x);
+
+    std::ofstream f{path, std::ios::binary};
+    if (!f.write(std::data(out_), std::size(out_))) {
+      std::cerr << "cannot write snapshot " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  // hoisted slots are the loop optimizer's, not the program's.
+  static bool saved(const symbol *k) noexcept { return k->str()[0] != '%'; }
+
+  snapshot_kind kind(const object &x) const {
+    if (dynamic_cast<const lox_list *>(&x))
+      return snapshot_kind::list;
+    if (dynamic_cast<const lox_map *>(&x))
+      return snapshot_kind::map;
+    if (dynamic_cast<const f64_array *>(&x))
+      return snapshot_kind::array;
+    if (dynamic_cast<const lox_function *>(&x))
+      return snapshot_kind::function;
+    return snapshot_kind::native;
+  }
+
+  // a scope's parent is numbered before it, so no chain of parents read back
+  // can loop.
+  void number(const std::shared_ptr<env> &e) {
+    if (e == nullptr || env_ids_.contains(e.get()))
+      return;
+    number(e->prev_);
+    env_ids_.emplace(e.get(), std::size(envs_));
+    envs_.push_back(e);
+  }
+
+  void number(const value &v) {
+    if (!is_object(v))
+      return;
+    const auto &x{std::get<std::shared_ptr<object>>(v)};
+    if (object_ids_.emplace(x.get(), std::size(objects_)).second)
+      objects_.push_back(x);
+  }
+
+  void scan(const env &e) {
+    e.symbols_.for_each([&](const symbol *k, const value &v) {
+      if (saved(k))
+        number(v);
+    });
+  }
+
+  bool scan(const object &x) {
+    if (auto l{dynamic_cast<const lox_list *>(&x)}) {
+      for (auto &&y : l->items_)
+        number(y);
+    } else if (auto m{dynamic_cast<const lox_map *>(&x)}) {
+      m->for_each([&](const value &, const value &v) { number(v); });
+    } else if (auto f{dynamic_cast<const lox_function *>(&x)}) {
+      const auto d{f->decl_};
+      if (d->last_ > std::size(tokens_) ||
+          tokens_[d->first_].type_ != token_type::fun__) {
+        x.print(std::cerr << "cannot snapshot ")
+            << ", declared outside the program" << std::endl;
+        return false;
+      }
+      number(f->closure_);
+      if (decl_ids_.emplace(f->decl_, std::size(decls_)).second)
+        decls_.push_back(f->decl_);
+    } else if (!dynamic_cast<const f64_array *>(&x) &&
+               !natives_.contains(typeid(x))) {
+      x.print(std::cerr << "cannot snapshot ") << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  template <typename T> void put(T x) {
+    out_.append(reinterpret_cast<const char *>(&x), sizeof x);
+  }
+
+  void put_string(std::string_view s) {
+    put<std::uint32_t>(std::size(s));
+    out_.append(s);
+  }
+
+  void put_value(const value &v) {
+    if (is_number(v)) {
+      put(snapshot_tag::number);
+      put(std::get<double>(v));
+    } else if (is_string(v)) {
+      put(snapshot_tag::string);
+      put_string(std::get<lox_string>(v));
+    } else if (is_bool(v)) {
+      put(snapshot_tag::boolean);
+      put<std::uint8_t>(std::get<bool>(v));
+    } else if (is_error(v)) {
+      put(snapshot_tag::error);
+      put(static_cast<std::uint8_t>(std::get<expr_error>(v)));
+    } else {
+      put(snapshot_tag::object);
+      put<std::uint64_t>(
+          object_ids_[std::get<std::shared_ptr<object>>(v).get()]);
+    }
+  }
+
+  void put_contents(const object &x) {
+    if (auto l{dynamic_cast<const lox_list *>(&x)}) {
+      put<std::uint64_t>(std::size(l->items_));
+      for (auto &&y : l->items_)
+        put_value(y);
+    } else if (auto m{dynamic_cast<const lox_map *>(&x)}) {
+      put<std::uint64_t>(m->size());
+      m->for_each([&](const value &k, const value &v) {
+        put_value(k);
+        put_value(v);
+      });
+    } else if (auto a{dynamic_cast<const f64_array *>(&x)}) {
+      put<std::uint64_t>(std::size(a->data_));
+      out_.append(reinterpret_cast<const char *>(std::data(a->data_)),
+                  std::size(a->data_) * sizeof(double));
+    } else if (auto f{dynamic_cast<const lox_function *>(&x)}) {
+      put<std::uint64_t>(decl_ids_[f->decl_]);
+      put<std::uint64_t>(env_ids_[f->closure_.get()]);
+    }
+  }
+
+  const session &session_;
+  const token_list &tokens_;
+  std::unordered_map<std::type_index, std::string> natives_{};
+
+  std::vector<std::shared_ptr<env>> envs_{};
+  std::unordered_map<const env *, std::uint64_t> env_ids_{};
+  std::vector<std::shared_ptr<object>> objects_{};
+  std::unordered_map<const object *, std::uint64_t> object_ids_{};
+  std::vector<const fun_stmt *> decls_{};
+  std::unordered_map<const fun_stmt *, std::uint64_t> decl_ids_{};
+
+  std::string out_{};
+};
+
+class snapshot_reader final {
+public:
+  snapshot_reader(std::string_view image) : image_{image} {}
+
+  // restores the image into the global scope of s, which has run nothing
+  // yet. memoizable says whether the functions it binds may be memoized.
+  bool operator()(session &s, bool memoizable) {
+    if (!image_.starts_with(snapshot_magic__))
+      return false;
+    next_ = std::size(snapshot_magic__);
+
+    token_list tokens{};
+    const auto n{fits(get<std::uint64_t>())};
+    tokens.reserve(n);
+    for (std::size_t i{}; i < n && !bad_; ++i) {
+      const auto type{get<std::uint8_t>()};
+      const auto line{get<std::int32_t>()};
+      tokens.emplace_back(static_cast<token_type>(type),
+                          std::string{get_string()}, line);
+    }
+    if (bad_ || tokens.empty() || tokens.back().type_ != token_type::eof__)
+      return false;
+
+    // each declaration is parsed by itself, in place in the prelude's
+    // tokens.
+    std::vector<std::unique_ptr<stmt>> decls(fits(get<std::uint64_t>()));
+    std::vector<const fun_stmt *> funs(std::size(decls));
+    parser p{std::move(tokens)};
+    for (std::size_t i{}; i < std::size(decls) && !bad_; ++i) {
+      const auto first{get<std::uint64_t>()}, last{get<std::uint64_t>()};
+      if (bad_ || first >= last || last >= std::size(p.tokens_) ||
+          p.tokens_[first].type_ != token_type::fun__)
+        return false;
+      decls[i] = p.declaration_at(first);
+      funs[i] = dynamic_cast<const fun_stmt *>(decls[i].get());
+      if (p.error_ || funs[i] == nullptr || p.current_ != last)
+        return false;
+    }
+
+    std::vector<std::shared_ptr<env>> envs(fits(get<std::uint64_t>()));
+    objects_.resize(fits(get<std::uint64_t>()));
+    if (bad_ || envs.empty())
+      return false;
+
+    envs[0] = s.globals();
+    for (std::size_t i{1}; i < std::size(envs); ++i)
+      envs[i] = make_env();
+
+    for (auto &&x : objects_) {
+      switch (static_cast<snapshot_kind>(get<std::uint8_t>())) {
+        using enum snapshot_kind;
+      default:
+        return false;
+      case list:
+        x = std::make_shared<lox_list>();
+        break;
+      case map:
+        x = std::make_shared<lox_map>();
+        break;
+      case array:
+        x = std::make_shared<f64_array>(0);
+        break;
+      case function:
+        x = std::make_shared<lox_function>(nullptr, nullptr);
+        break;
+      case native: {
+        const auto y{s.globals()->symbols_.find(symbol::intern(get_string()))};
+        if (y == nullptr || !is_object(*y))
+          return false;
+        x = std::get<std::shared_ptr<object>>(*y);
+      }
+      }
+    }
+
+    for (std::size_t i{}; i < std::size(envs); ++i) {
+      // a parent comes before its scope; one that doesn't could close a loop.
+      const auto &e{envs[i]};
+      const auto prev{get<std::uint64_t>()};
+      if (prev > i)
+        return false;
+      if (prev != 0)
+        e->prev_ = envs[prev - 1];
+      for (auto n{get<std::uint64_t>()}; n-- > 0 && !bad_;) {
+        const auto k{symbol::intern(get_string())};
+        e->symbols_[k] = get_value();
+      }
+    }
+
+    for (auto &&x : objects_) {
+      if (auto l{std::dynamic_pointer_cast<lox_list>(x)}) {
+        const auto n{fits(get<std::uint64_t>())};
+        l->items_.reserve(n);
+        for (std::size_t i{}; i < n && !bad_; ++i)
+          l->items_.push_back(get_value());
+      } else if (auto m{std::dynamic_pointer_cast<lox_map>(x)}) {
+        const auto n{fits(get<std::uint64_t>())};
+        m->reserve(n);
+        for (std::size_t i{}; i < n && !bad_; ++i) {
+          const auto k{get_value()};
+          if (!lox_map::is_key(k))
+            return false;
+          (*m)[k] = get_value();
+        }
+      } else if (auto a{std::dynamic_pointer_cast<f64_array>(x)}) {
+        const auto n{get<std::uint64_t>()};
+        if (n > (std::size(image_) - next_) / sizeof(double))
+          return false;
+        a->data_.resize(n);
+        std::memcpy(std::data(a->data_), std::data(image_) + next_,
+                    n * sizeof(double));
+        next_ += n * sizeof(double);
+      } else if (auto f{std::dynamic_pointer_cast<lox_function>(x)}) {
+        // natives are left as they are.
+        const auto decl{get<std::uint64_t>()}, closure{get<std::uint64_t>()};
+        if (decl >= std::size(funs) || closure >= std::size(envs))
+          return false;
+        f->decl_ = funs[decl];
+        f->closure_ = envs[closure];
+      }
+    }
+
+    if (bad_ || next_ != std::size(image_))
+      return false;
+
+    // declarations bound to their own name at the top level are what a
+    // program declaring them would have left; only those may be memoized.
+    std::vector<std::unique_ptr<stmt>> top{}, rest{};
+    for (std::size_t i{}; i < std::size(decls); ++i) {
+      const auto x{s.globals()->symbols_.find(funs[i]->symbol_)};
+      const auto f{x == nullptr ? nullptr : to_object<lox_function>(*x)};
+      (f != nullptr && f->decl_ == funs[i] && f->closure_ == envs[0] ? top
+                                                                      : rest)
+          .push_back(std::move(decls[i]));
+    }
+    s.adopt(std::move(top), memoizable);
+    s.adopt(std::move(rest), false);
+    return true;
+  }
+
+private:
+  template <typename T> T get() {
+    T x{};
+    if (std::size(image_) - next_ < sizeof x) {
+      bad_ = true;
+      return x;
+    }
+    std::memcpy(&x, std::data(image_) + next_, sizeof x);
+    next_ += sizeof x;
+    return x;
+  }
+
+  std::string_view get_string() {
+    const auto n{get<std::uint32_t>()};
+    if (std::size(image_) - next_ < n) {
+      bad_ = true;
+      return {};
+    }
+    return image_.substr(std::exchange(next_, next_ + n), n);
+  }
+
+  value get_value() {
+    switch (static_cast<snapshot_tag>(get<std::uint8_t>())) {
+      using enum snapshot_tag;
+    case number:
+      return get<double>();
+    case string:
+      return lox_string{get_string()};
+    case boolean:
+      return get<std::uint8_t>() != 0;
+    case error:
+      return static_cast<expr_error>(get<std::uint8_t>());
+    case object:
+      if (const auto i{get<std::uint64_t>()}; i < std::size(objects_))
+        return objects_[i];
+    }
+    bad_ = true;
+    return {};
+  }
+
+  // n, if that many things of a byte or more could be left in the image.
+  std::size_t fits(std::uint64_t n) {
+    if (n > std::size(image_) - next_)
+      bad_ = true;
+    return bad_ ? 0 : n;
+  }
+
+  std::string_view image_{};
+  std::size_t next_{};
+  bool bad_{};
+  std::vector<std::shared_ptr<object>> objects_{};
+};
+
+// writes the global scope of s, which has run the one program lexed into
+// tokens, to path.
+bool save_snapshot(const std::string &path, const session &s,
+                   const token_list &tokens) {
+  return snapshot_writer{s, tokens}(path);
+}
+
+// starts s from the image at path, as if it had run the program saved
+// there.
+bool load_snapshot(const std::string &path, session &s,
+                   bool memoizable = true) {
+  const auto fd{open(path.c_str(), O_RDONLY)};
+  struct stat st{};
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    if (fd >= 0)
+      close(fd);
+    std::cerr << "cannot read snapshot " << path << std::endl;
+    return false;
+  }
+
+  const auto n{static_cast<std::size_t>(st.st_size)};
+  const auto p{mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0)};
+  close(fd);
+  if (p == MAP_FAILED) {
+    std::cerr << "cannot read snapshot " << path << std::endl;
+    return false;
+  }
+
+  const auto ok{snapshot_reader{{static_cast<const char *>(p), n}}(
+      s, memoizable)};
+  munmap(p, n);
+  if (!ok)
+    std::cerr << "bad snapshot " << path << std::endl;
+  return ok;
+}
\ No newline at end of file
@@ -1,49 +1,95 @@
+#pragma once
+
 #include "expr.h"
+#include "memo.h"
+#include "output.h"
 
+#include <algorithm>
 #include <initializer_list>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// sink for print statements. batch tasks point it at their own buffer so
+// outputs can be collected per input.
+thread_local output *out__{&standard_output()};
+
+// set by a return statement and taken by the enclosing call. statements stop
+// executing while it is engaged.
+thread_local std::optional<value> return_value__{};
+
+// a call made by `return f(...)`, left for the enclosing call to make in its
+// own frame instead of a new one.
+struct tail_call final {
+  std::shared_ptr<function> f_{};
+  std::vector<value> args_{};
+};
+
+thread_local tail_call tail_call__{};
 
-std::ostream &
-operator<<(std::ostream &os,
-           const std::variant<double, std::string, bool, expr_error> v) {
-  if (is_number(v))
-    return os << std::get<double>(v);
-  if (is_string(v))
-    return os << std::get<std::string>(v);
-  if (is_bool(v))
-    return os << std::get<bool>(v);
-  return os << std::get<expr_error>(v);
+// an expression standing in for a call, such as an inlined one, that a
+// return can still end with a tail call. bind leaves the function null, and
+// the value in result, if there is no call left to make.
+struct tail_expr : expr {
+  virtual std::pair<std::shared_ptr<function>, std::vector<value>>
+  bind(std::shared_ptr<env> environ, value &result) const noexcept = 0;
+};
+
+bool unwinding() noexcept {
+  return return_value__.has_value() || halted();
 }
 
-struct stmt {
+struct stmt : tracked_new<subsystem::ast> {
+  virtual ~stmt() = default;
   virtual void operator()(std::shared_ptr<env>) const noexcept {}
+  // whether running this can create a function pointing back into the tree.
+  virtual bool declares_function() const noexcept { return false; }
 };
 
 struct block_stmt final : stmt {
   std::vector<std::unique_ptr<stmt>> stmts_{};
+  // cleared for blocks that declare nothing, which can share the enclosing
+  // scope.
+  bool scoped_{true};
 
   void operator()(std::shared_ptr<env> environ) const noexcept override {
-    for (auto scope{std::make_shared<env>(environ)}; auto &&x : stmts_)
+    run(scoped_ ? make_env(environ) : environ);
+  }
+
+  // runs the statements directly in scope.
+  void run(std::shared_ptr<env> scope) const noexcept {
+    for (auto &&x : stmts_) {
+      if (unwinding())
+        break;
       x->operator()(scope);
+    }
+  }
+
+  bool declares_function() const noexcept override {
+    return std::ranges::any_of(stmts_,
+                               [](auto &&x) { return x->declares_function(); });
   }
 };
 
 struct decl_stmt final : stmt {
   token identifier_{};
+  const symbol *symbol_{};
   std::unique_ptr<expr> value_{};
 
   decl_stmt(token identifier, std::unique_ptr<expr> value)
-      : identifier_{identifier}, value_{std::move(value)} {}
+      : identifier_{identifier}, symbol_{symbol::intern(identifier.lexeme_)},
+        value_{std::move(value)} {}
 
   void operator()(std::shared_ptr<env> environ) const noexcept override {
-    if (environ->symbols_.contains(identifier_.lexeme_)) {
+    if (environ->symbols_.contains(symbol_)) {
       std::cerr << identifier_.lexeme_ << " already declared." << std::endl;
       return;
     }
 
-    environ->symbols_[identifier_.lexeme_] =
+    environ->symbols_[symbol_] =
         value_ == nullptr
-            ? std::variant<double, std::string, bool, expr_error>{}
+            ? value{}
             : value_->operator()(environ);
   }
 };
@@ -58,15 +104,50 @@ struct expr_stmt final : stmt {
   }
 };
 
+// a function body the parser has only checked for balanced brackets: its
+// tokens from the opening brace on, spelled out again with a space between
+// each, which is far smaller than the tokens, and where that brace sits in
+// the program's tokens.
+struct lazy_body final {
+  std::basic_string<char, std::char_traits<char>,
+                    tracked<char, subsystem::tokens>>
+      source_{};
+  std::size_t first_{};
+  // the names the body assigns or declares, noted while preparsing so that
+  // analyses needing only these leave the body unparsed.
+  std::vector<const symbol *> binds_{};
+  std::once_flag parsed_{};
+};
+
 struct fun_stmt final : stmt {
   token name_{};
   std::vector<token> params_{};
-  std::unique_ptr<stmt> body_{};
+  // null until a lazy body is parsed, and after if it does not parse.
+  mutable std::unique_ptr<stmt> body_{};
+  // set when the body is left to be parsed on the first call.
+  std::unique_ptr<lazy_body> lazy_{};
+  // set when the function is proven pure and calls to it are memoized.
+  std::unique_ptr<memo> memo_{};
+  const symbol *symbol_{};
+  std::vector<const symbol *> param_symbols_{};
+  // where the declaration sits in its program's tokens, as [first, last).
+  std::size_t first_{}, last_{};
 
   fun_stmt(token &&name, std::vector<token> &&params,
            std::unique_ptr<stmt> body)
       : name_{std::move(name)}, params_{std::move(params)},
-        body_{std::move(body)} {}
+        body_{std::move(body)}, symbol_{symbol::intern(name_.lexeme_)} {
+    for (auto &&x : params_)
+      param_symbols_.push_back(symbol::intern(x.lexeme_));
+  }
+
+  void operator()(std::shared_ptr<env> environ) const noexcept override;
+
+  bool declares_function() const noexcept override { return true; }
+
+  // the body, parsed and optimized first if it was left for later. null if
+  // it does not parse. safe to call from any thread.
+  const block_stmt *body() const noexcept;
 };
 
 struct if_stmt final : stmt {
@@ -84,6 +165,51 @@ struct if_stmt final : stmt {
     else if (else_branch_ != nullptr)
       else_branch_->operator()(environ);
   }
+
+  bool declares_function() const noexcept override {
+    return if_branch_->declares_function() ||
+           (else_branch_ != nullptr && else_branch_->declares_function());
+  }
+};
+
+struct return_stmt final : stmt {
+  std::unique_ptr<expr> value_{};
+  const call_expr *tail_call_{};
+  // set instead of tail_call_ once the call is replaced by a tail_expr.
+  const tail_expr *tail_expr_{};
+
+  return_stmt(std::unique_ptr<expr> value)
+      : value_{std::move(value)},
+        tail_call_{dynamic_cast<const call_expr *>(value_.get())} {}
+
+  void operator()(std::shared_ptr<env> environ) const noexcept override {
+    if (tail_expr_ != nullptr) {
+      value result{};
+      auto [f, args]{tail_expr_->bind(environ, result)};
+      if (f == nullptr) {
+        return_value__ = std::move(result);
+        return;
+      }
+      tail_call__ = {std::move(f), std::move(args)};
+      return_value__ = value{};
+      return;
+    }
+
+    if (tail_call_ == nullptr) {
+      return_value__ =
+          value_ == nullptr ? value{} : value_->operator()(environ);
+      return;
+    }
+
+    auto [f, args]{tail_call_->bind(environ)};
+    if (f == nullptr) {
+      return_value__ = expr_error::not_callable;
+      return;
+    }
+
+    tail_call__ = {std::move(f), std::move(args)};
+    return_value__ = value{};
+  }
 };
 
 struct print_stmt final : stmt {
@@ -92,19 +218,219 @@ struct print_stmt final : stmt {
   print_stmt(std::unique_ptr<expr> e) : expr_{std::move(e)} {}
 
   void operator()(std::shared_ptr<env> environ) const noexcept override {
-    std::cout << expr_->operator()(environ) << std::endl;
+    if (const auto x{expr_->operator()(environ)}; !error__.has_value())
+      out__->println(x);
   }
 };
 
+// a loop whose condition compares a number variable to a bound, and whose
+// unscoped body block ends by stepping the variable by a constant.
+struct counter final {
+  const symbol *symbol_{};
+  token_type op_{};
+  const expr *bound_{};
+  // whether the bound can't change while the loop runs.
+  bool fixed_{};
+  double step_{};
+};
+
 struct while_stmt final : stmt {
   std::unique_ptr<expr> condition_{};
   std::unique_ptr<stmt> body_{};
+  // loop invariant expressions, evaluated into the named slots of the
+  // enclosing scope before the first iteration and read from there instead.
+  std::vector<std::pair<const symbol *, std::unique_ptr<expr>>> hoisted_{};
+  std::optional<counter> counter_{};
 
   while_stmt(std::unique_ptr<expr> condition, std::unique_ptr<stmt> body)
       : condition_{std::move(condition)}, body_{std::move(body)} {}
 
   void operator()(std::shared_ptr<env> environ) const noexcept override {
-    for (; to_bool(condition_->operator()(environ));)
-      body_->operator()(environ);
+    for (auto &&[k, e] : hoisted_)
+      environ->symbols_[k] = e->operator()(environ);
+
+    if (!counter_.has_value() || !count(environ))
+      for (; !unwinding() && !tick() &&
+             to_bool(condition_->operator()(environ));)
+        body_->operator()(environ);
+
+    for (auto &&[k, _] : hoisted_)
+      environ->symbols_.erase(k);
+  }
+
+  bool declares_function() const noexcept override {
+    return body_->declares_function();
   }
-};
\ No newline at end of file
+
+private:
+  // runs the loop keeping the counter in a double, storing it back to its
+  // slot once per step for the body to read. returns false, having run
+  // nothing, if the counter doesn't hold a number.
+  bool count(const std::shared_ptr<env> &environ) const noexcept {
+    auto scope{environ.get()};
+    for (; scope != nullptr && !scope->symbols_.contains(counter_->symbol_);
+         scope = scope->prev_.get())
+      ;
+
+    if (scope == nullptr || !is_number(scope->symbols_[counter_->symbol_]))
+      return false;
+
+    const auto &body{static_cast<const block_stmt &>(*body_).stmts_};
+    const auto fixed{counter_->fixed_ ? counter_->bound_->operator()(environ)
+                                      : value{}};
+
+    // the body may add symbols to the scope, moving the counter's slot, so
+    // it is looked up again at each step.
+    const auto k{counter_->symbol_};
+    for (auto i{std::get<double>(scope->symbols_[k])}; !unwinding() && !tick();
+         scope->symbols_[k] = i += counter_->step_) {
+      const auto n{counter_->fixed_ ? fixed
+                                    : counter_->bound_->operator()(environ)};
+      if (!is_number(n) || !compare(i, std::get<double>(n)))
+        break;
+
+      for (std::size_t j{}; j + 1 < std::size(body) && !unwinding(); ++j)
+        body[j]->operator()(environ);
+
+      if (unwinding())
+        break;
+    }
+
+    return true;
+  }
+
+  bool compare(double i, double n) const noexcept {
+    switch (counter_->op_) {
+      using enum token_type;
+    default:
+      return false;
+    case less__:
+      return i < n;
+    case lessequal__:
+      return i <= n;
+    case greater__:
+      return i > n;
+    case greaterequal__:
+      return i >= n;
+    }
+  }
+};
+
+struct frame final {
+  const fun_stmt *decl_{};
+  std::shared_ptr<env> scope_{};
+};
+
+// the lox frames live on this stack. a tail call reuses its caller's frame;
+// any other call also recurses on the native stack to evaluate the call.
+thread_local std::vector<frame> call_stack__{};
+
+struct lox_function final : function {
+  const fun_stmt *decl_{};
+  std::shared_ptr<env> closure_{};
+
+  lox_function(const fun_stmt *decl, std::shared_ptr<env> closure)
+      : decl_{decl}, closure_{closure} {}
+
+  std::size_t arity() const noexcept override {
+    return std::size(decl_->params_);
+  }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (decl_->memo_ == nullptr ||
+        !std::ranges::all_of(args, &memo::cacheable))
+      return invoke(std::move(args));
+
+    if (auto hit{decl_->memo_->find(args)})
+      return *std::move(hit);
+
+    auto result{invoke(args)};
+    if (memo::cacheable(result) && !error__.has_value())
+      decl_->memo_->insert(std::move(args), result);
+    return result;
+  }
+
+  std::ostream &print(std::ostream &os) const override {
+    return os << "<fn " << decl_->name_.lexeme_ << ">";
+  }
+
+  std::shared_ptr<object> copy(std::shared_ptr<object>,
+                               copier &c) const override {
+    return std::make_shared<lox_function>(decl_, c(closure_));
+  }
+
+private:
+  value invoke(std::vector<value> args) const noexcept {
+    if (std::size(call_stack__) >= max_depth__ || stack_exhausted())
+      return fail(expr_error::stack_overflow);
+
+    call_stack__.emplace_back();
+
+    // tail calls loop here, reusing the frame and, unless a closure kept
+    // hold of it, the scope too.
+    std::shared_ptr<function> callee{};
+    for (auto f{this};;) {
+      auto &top{call_stack__.back()};
+      top.decl_ = f->decl_;
+
+      if (top.scope_.use_count() == 1) {
+        top.scope_->symbols_.clear();
+        top.scope_->prev_ = f->closure_;
+      } else {
+        top.scope_ = make_env(f->closure_);
+      }
+
+      const auto body{f->decl_->body()};
+      if (body == nullptr) {
+        call_stack__.pop_back();
+        return fail(expr_error::syntax_error);
+      }
+
+      const auto scope{top.scope_};
+      for (std::size_t i{}; i < std::size(args); ++i)
+        scope->symbols_[f->decl_->param_symbols_[i]] = std::move(args[i]);
+
+      body->run(scope);
+
+      auto result{
+          std::exchange(return_value__, std::nullopt).value_or(value{})};
+      auto next{std::exchange(tail_call__, {})};
+
+      if (error__.has_value() || next.f_ == nullptr) {
+        call_stack__.pop_back();
+        return error__.has_value() ? *error__ : result;
+      }
+
+      callee = std::move(next.f_);
+      args = std::move(next.args_);
+      f = dynamic_cast<const lox_function *>(callee.get());
+
+      if (f == nullptr || f->arity() != std::size(args)) {
+        call_stack__.pop_back();
+        return callee->call(std::move(args));
+      }
+
+      // a tail call is still a call, though it skips function::call.
+      if (tick()) {
+        call_stack__.pop_back();
+        return *error__;
+      }
+    }
+  }
+};
+
+void fun_stmt::operator()(std::shared_ptr<env> environ) const noexcept {
+  environ->symbols_[symbol_] =
+      std::make_shared<lox_function>(this, environ);
+}
+
+value assign_expr::operator()(std::shared_ptr<env> environ) const noexcept {
+  // the right operand runs before the slot is looked up again, so nothing
+  // it inserts can move the slot from under the assignment.
+  for (auto e{environ.get()}; e != nullptr; e = e->prev_.get())
+    if (e->symbols_.contains(symbol_))
+      return e->symbols_[symbol_] = rhs_->operator()(environ);
+
+  out__->write("undefined identifier " + identifier_.lexeme_ + "\n");
+  return expr_error::undefined_identifier;
+}
\ No newline at end of file
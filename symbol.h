@@ -0,0 +1,161 @@
+#pragma once
+
+#include "mem.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// an interned identifier. every occurrence of a name shares one symbol, so
+// symbols compare by address and their hash is computed once.
+class symbol final {
+public:
+  static const symbol *intern(std::string_view s) {
+    static std::mutex mutex{};
+    static std::unordered_map<std::string_view, std::unique_ptr<symbol>>
+        symbols{};
+
+    std::lock_guard lock{mutex};
+    if (const auto x{symbols.find(s)}; x != std::end(symbols))
+      return x->second.get();
+
+    std::unique_ptr<symbol> x{new symbol{std::string{s}}};
+    const auto key{std::string_view{x->str_}};
+    return symbols.emplace(key, std::move(x)).first->second.get();
+  }
+
+  const std::string &str() const noexcept { return str_; }
+  std::size_t hash() const noexcept { return hash_; }
+
+private:
+  symbol(std::string s)
+      : str_{std::move(s)}, hash_{std::hash<std::string>{}(str_)} {}
+
+  const std::string str_{};
+  const std::size_t hash_{};
+};
+
+// a flat map from symbols to V with robin hood probing. an entry sits as
+// close to its home slot as the entries before it allow, which keeps probes
+// short at high load; erasing shifts the entries after it back instead of
+// leaving a tombstone. pointers to values are invalidated by insertion and
+// erasure.
+template <typename V> class symbol_table final {
+public:
+  V *find(const symbol *k) noexcept {
+    if (size_ == 0)
+      return nullptr;
+
+    const auto mask{std::size(slots_) - 1};
+    auto i{k->hash() & mask};
+    for (std::uint32_t d{};; i = (i + 1) & mask, ++d) {
+      auto &x{slots_[i]};
+      if (x.key_ == k)
+        return &x.value_;
+      if (x.key_ == nullptr || x.distance_ < d)
+        return nullptr;
+    }
+  }
+
+  const V *find(const symbol *k) const noexcept {
+    return const_cast<symbol_table *>(this)->find(k);
+  }
+
+  bool contains(const symbol *k) const noexcept { return find(k) != nullptr; }
+
+  V &operator[](const symbol *k) {
+    if (const auto x{find(k)})
+      return *x;
+    if ((size_ + 1) * 4 > std::size(slots_) * 3)
+      grow();
+    return insert({k, V{}, 0});
+  }
+
+  V &operator[](std::string_view k) { return operator[](symbol::intern(k)); }
+
+  bool erase(const symbol *k) noexcept {
+    if (size_ == 0)
+      return false;
+
+    const auto mask{std::size(slots_) - 1};
+    auto i{k->hash() & mask};
+    for (std::uint32_t d{}; slots_[i].key_ != k; i = (i + 1) & mask, ++d)
+      if (slots_[i].key_ == nullptr || slots_[i].distance_ < d)
+        return false;
+
+    for (auto j{(i + 1) & mask};
+         slots_[j].key_ != nullptr && slots_[j].distance_ > 0;
+         i = j, j = (j + 1) & mask) {
+      slots_[i] = std::move(slots_[j]);
+      --slots_[i].distance_;
+    }
+    slots_[i] = {};
+    --size_;
+    return true;
+  }
+
+  // empties the table, keeping its slots for reuse.
+  void clear() noexcept {
+    if (size_ == 0)
+      return;
+    for (auto &&x : slots_)
+      x = {};
+    size_ = 0;
+  }
+
+  std::size_t size() const noexcept { return size_; }
+
+  void for_each(auto &&f) const {
+    for (auto &&x : slots_)
+      if (x.key_ != nullptr)
+        f(x.key_, x.value_);
+  }
+
+private:
+  struct slot final {
+    const symbol *key_{};
+    V value_{};
+    // how far the entry is from its home slot.
+    std::uint32_t distance_{};
+  };
+
+  V &insert(slot s) {
+    const auto mask{std::size(slots_) - 1};
+    V *placed{};
+    for (auto i{s.key_->hash() & mask};; i = (i + 1) & mask, ++s.distance_) {
+      auto &x{slots_[i]};
+      if (x.key_ == nullptr) {
+        x = std::move(s);
+        ++size_;
+        return placed == nullptr ? x.value_ : *placed;
+      }
+      // take the slot from an entry nearer its home, and carry on placing
+      // that one instead.
+      if (x.distance_ < s.distance_) {
+        std::swap(x, s);
+        if (placed == nullptr)
+          placed = &x.value_;
+      }
+    }
+  }
+
+  void grow() {
+    auto old{std::exchange(
+        slots_, decltype(slots_)(std::max<std::size_t>(
+                    4, std::size(slots_) * 2)))};
+    size_ = 0;
+    for (auto &&x : old)
+      if (x.key_ != nullptr)
+        insert({x.key_, std::move(x.value_), 0});
+  }
+
+  std::vector<slot, tracked<slot, subsystem::envs>> slots_{};
+  std::size_t size_{};
+};
\ No newline at end of file
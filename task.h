@@ -0,0 +1,182 @@
+#pragma once
+
+#include "expr.h"
+#include "io.h"
+#include "pool.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+// lox tasks are multiplexed onto one pool of native threads, which grows only
+// when tasks block on each other.
+pool &scheduler() {
+  static pool p{};
+  return p;
+}
+
+// blocks the calling task until done() holds. returns false, having failed
+// the program, if the run must stop first or the scheduler shuts down.
+template <typename F> bool wait_until(F &&done) {
+  if (scheduler().block_until([&] { return stopped() || done(); }) &&
+      !error__.has_value())
+    return true;
+  if (!error__.has_value())
+    fail(expr_error::interrupted);
+  return false;
+}
+
+struct task final : object {
+  std::atomic<bool> done_{};
+  value result_{};
+
+  std::ostream &print(std::ostream &os) const override {
+    return os << "<task>";
+  }
+};
+
+struct channel final : object {
+  std::mutex mutex_{};
+  std::deque<value> values_{};
+  const std::size_t capacity_{};
+
+  channel(std::size_t capacity) : capacity_{capacity} {}
+
+  std::ostream &print(std::ostream &os) const override {
+    return os << "<chan>";
+  }
+};
+
+// spawn(f, args...) runs f(args...) as a new task. f and its arguments are
+// copied, so the task never sees the spawner's scopes.
+struct spawn final : function {
+  std::size_t arity() const noexcept override { return variadic__; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (args.empty())
+      return expr_error::arity_mismatch;
+
+    copier copy{};
+    for (auto &&x : args)
+      x = copy(x);
+
+    const auto f{to_function(args.front())};
+    if (f == nullptr)
+      return expr_error::not_callable;
+    args.erase(std::begin(args));
+
+    // the task spends its spawner's budget, which counts it until it is
+    // done so the session can wait for it before freeing what it runs.
+    auto t{std::make_shared<task>()};
+    if (budget__ != nullptr)
+      budget__->enter();
+    scheduler().submit([t, f, args{std::move(args)}, b{budget__}]() mutable {
+      charge_to(b);
+      t->result_ = f->call(std::move(args));
+      io_loop().run();
+      error__.reset();
+      charge_to(nullptr);
+      t->done_ = true;
+      if (b != nullptr)
+        b->leave();
+    });
+
+    return t;
+  }
+};
+
+// join(t) waits for t and returns a copy of its result. like send and recv,
+// it gives up if the run is interrupted or runs out of time meanwhile.
+struct join final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto t{to_object<task>(args.front())};
+    if (t == nullptr)
+      return expr_error::invalid_operands;
+
+    if (!wait_until([&] { return t->done_.load(); }))
+      return *error__;
+
+    copier copy{};
+    return copy(t->result_);
+  }
+};
+
+// chan(n) makes a channel holding at most n values.
+struct chan final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    if (!is_number(args.front()) || std::get<double>(args.front()) < 1)
+      return expr_error::invalid_operands;
+    return std::make_shared<channel>(
+        static_cast<std::size_t>(std::get<double>(args.front())));
+  }
+};
+
+// send(c, x) puts a copy of x on c, waiting while c is full.
+struct send final : function {
+  std::size_t arity() const noexcept override { return 2; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto c{to_object<channel>(args.front())};
+    if (c == nullptr)
+      return expr_error::invalid_operands;
+
+    copier copy{};
+    auto x{copy(args.back())};
+
+    for (;;) {
+      {
+        std::lock_guard lock{c->mutex_};
+        if (std::size(c->values_) < c->capacity_) {
+          c->values_.push_back(std::move(x));
+          break;
+        }
+      }
+
+      if (!wait_until([&] {
+            std::lock_guard lock{c->mutex_};
+            return std::size(c->values_) < c->capacity_;
+          }))
+        return *error__;
+    }
+
+    scheduler().notify();
+    return true;
+  }
+};
+
+// recv(c) takes the oldest value off c, waiting while c is empty.
+struct recv final : function {
+  std::size_t arity() const noexcept override { return 1; }
+
+  value operator()(std::vector<value> args) const noexcept override {
+    const auto c{to_object<channel>(args.front())};
+    if (c == nullptr)
+      return expr_error::invalid_operands;
+
+    value x{};
+
+    for (;;) {
+      {
+        std::lock_guard lock{c->mutex_};
+        if (!c->values_.empty()) {
+          x = std::move(c->values_.front());
+          c->values_.pop_front();
+          break;
+        }
+      }
+
+      if (!wait_until([&] {
+            std::lock_guard lock{c->mutex_};
+            return !c->values_.empty();
+          }))
+        return *error__;
+    }
+
+    scheduler().notify();
+    return x;
+  }
+};
\ No newline at end of file
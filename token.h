@@ -1,11 +1,20 @@
 #pragma once
 
+#include "mem.h"
 #include "token_type.h"
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 struct token final {
   const token_type type_{};
   const std::string lexeme_{};
   const int line_{};
-};
\ No newline at end of file
+  // where the token's text starts in the source, and how many characters it
+  // spans, quotes included.
+  const std::uint32_t offset_{}, size_{};
+};
+
+// what the lexer hands the parser, charged to subsystem::tokens.
+using token_list = std::vector<token, tracked<token, subsystem::tokens>>;
\ No newline at end of file
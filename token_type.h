@@ -7,6 +7,9 @@ enum struct token_type {
   r_paren__,
   l_brace__,
   r_brace__,
+  l_bracket__,
+  r_bracket__,
+  colon__,
   dot__,
   semi__,
   comma__,
@@ -37,7 +40,9 @@ enum struct token_type {
   number__,
   identifier__,
   print__,
-  eof__
+  eof__,
+  // a character no token starts with.
+  unknown__
 };
 
 std::ostream &operator<<(std::ostream &os, const token_type &type) {
@@ -51,6 +56,12 @@ std::ostream &operator<<(std::ostream &os, const token_type &type) {
     return os << "'{'";
   case r_brace__:
     return os << "'}'";
+  case l_bracket__:
+    return os << "'['";
+  case r_bracket__:
+    return os << "']'";
+  case colon__:
+    return os << "':'";
   case dot__:
     return os << "'.'";
   case semi__:
@@ -113,5 +124,7 @@ std::ostream &operator<<(std::ostream &os, const token_type &type) {
     return os << "'print'";
   case eof__:
     return os << "eof";
+  case unknown__:
+    return os << "unexpected character";
   }
 }
\ No newline at end of file